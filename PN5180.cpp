@@ -21,6 +21,9 @@
 #include <Arduino.h>
 #include "PN5180.h"
 #include "Debug.h"
+#if defined(ARDUINO_ARCH_ESP32)
+#include <esp_system.h>   // esp_fill_random()
+#endif
 
 // PN5180 1-Byte Direct Commands
 // see 11.4.3.3 Host Interface Command List
@@ -33,11 +36,15 @@
 #define PN5180_SEND_DATA                (0x09)
 #define PN5180_READ_DATA                (0x0A)
 #define PN5180_SWITCH_MODE              (0x0B)
+#define PN5180_MIFARE_AUTHENTICATE      (0x0C)
 #define PN5180_LOAD_RF_CONFIG           (0x11)
 #define PN5180_RF_ON                    (0x16)
 #define PN5180_RF_OFF                   (0x17)
 
 uint8_t PN5180::readBuffer[508];
+uint8_t PN5180::numChips = 0;
+uint8_t PN5180::chipNss[PN5180_MAX_CHIPS];
+uint8_t PN5180::chipRFConfig[PN5180_MAX_CHIPS][2];
 
 PN5180::PN5180(uint8_t SSpin, uint8_t BUSYpin, uint8_t RSTpin) {
   PN5180_NSS = SSpin;
@@ -367,6 +374,52 @@ uint8_t * PN5180::readData(int len, uint8_t *buffer /* = NULL */) {
   return readBuffer;
 }
 
+/*
+ * MIFARE_AUTHENTICATE - 0x0C
+ * This command is used to perform a MIFARE Classic Authentication on an activated card.
+ * It takes the key, card UID and the key type to authenticate at given block address. The
+ * response contains 1 byte indicating the authentication status.
+ * Key type must be 0x60 (key A) or 0x61 (key B). For cards with a 7 byte UID the last 4
+ * UID bytes are used.
+ * On success the MFC_CRYPTO_ON bit of SYSTEM_CONFIG is set by the PN5180 and all
+ * further communication with the card is encrypted, until the bit is cleared by the host.
+ *
+ * return value:
+ *  0x00 = Authentication successful
+ *  0x01 = Authentication failed (permission denied)
+ *  0x02 = Timeout, no answer from the card
+ */
+uint8_t PN5180::mifareAuthenticate(uint8_t blockNo, const uint8_t *key, uint8_t keyType, const uint8_t *uid) {
+  PN5180DEBUG(F("Mifare Authenticate block="));
+  PN5180DEBUG(blockNo);
+  PN5180DEBUG(F(", keyType=0x"));
+  PN5180DEBUG(formatHex(keyType));
+  PN5180DEBUG("\n");
+
+  uint8_t cmd[13];
+  cmd[0] = PN5180_MIFARE_AUTHENTICATE;
+  for (int i=0; i<6; i++) {
+    cmd[1+i] = key[i];
+  }
+  cmd[7] = keyType;
+  cmd[8] = blockNo;
+  for (int i=0; i<4; i++) {
+    cmd[9+i] = uid[i];
+  }
+
+  uint8_t authStatus = 0xFF;
+
+  SPI.beginTransaction(PN5180_SPI_SETTINGS);
+  transceiveCommand(cmd, sizeof(cmd), &authStatus, 1);
+  SPI.endTransaction();
+
+  PN5180DEBUG(F("Authentication status=0x"));
+  PN5180DEBUG(formatHex(authStatus));
+  PN5180DEBUG("\n");
+
+  return authStatus;
+}
+
 /*
  * LOAD_RF_CONFIG - 0x11
  * Parameter 'Transmitter Configuration' must be in the range from 0x0 - 0x1C, inclusive. If
@@ -398,9 +451,47 @@ bool PN5180::loadRFConfig(uint8_t txConf, uint8_t rxConf) {
   transceiveCommand(cmd, 3);
   SPI.endTransaction();
 
+  uint8_t *active = activeRFConfig();
+  if (NULL != active) {
+    if (0xFF != txConf) active[0] = txConf;
+    if (0xFF != rxConf) active[1] = rxConf;
+  }
   return true;
 }
 
+/*
+ * Load an RF configuration only if it is not the one loaded last on this
+ * chip, by any object. Registers changed since the last LOAD_RF_CONFIG
+ * (e.g. CRC settings) keep their values then, use loadRFConfig() where they
+ * must be reset.
+ */
+bool PN5180::selectRFConfig(uint8_t txConf, uint8_t rxConf) {
+  uint8_t *active = activeRFConfig();
+  if ((NULL != active) && (txConf == active[0]) && (rxConf == active[1])) {
+    return true;
+  }
+  return loadRFConfig(txConf, rxConf);
+}
+
+/*
+ * Tracked RF configuration of the chip on this object's NSS pin,
+ * NULL if more than PN5180_MAX_CHIPS chips are in use.
+ */
+uint8_t * PN5180::activeRFConfig() {
+  for (int i=0; i<numChips; i++) {
+    if (chipNss[i] == PN5180_NSS) {
+      return chipRFConfig[i];
+    }
+  }
+  if (numChips >= PN5180_MAX_CHIPS) {
+    return NULL;
+  }
+  chipNss[numChips] = PN5180_NSS;
+  chipRFConfig[numChips][0] = 0xFF;  // unknown until the first LOAD_RF_CONFIG
+  chipRFConfig[numChips][1] = 0xFF;
+  return chipRFConfig[numChips++];
+}
+
 /*
  * RF_ON - 0x16
  * This command is used to switch on the internal RF field. If enabled the TX_RFON_IRQ is
@@ -544,6 +635,12 @@ void PN5180::reset() {
   while (0 == (IDLE_IRQ_STAT & getIRQStatus())); // wait for system to start up
 
   clearIRQStatus(0xffffffff); // clear all flags
+
+  uint8_t *active = activeRFConfig();  // the reset cleared the RF configuration
+  if (NULL != active) {
+    active[0] = 0xFF;
+    active[1] = 0xFF;
+  }
 }
 
 /**
@@ -571,6 +668,43 @@ bool PN5180::clearIRQStatus(uint32_t irqMask) {
   return writeRegister(IRQ_CLEAR, irqMask);
 }
 
+/*
+ * Poll the IRQ-Status register until one of the IRQs in irqMask is set,
+ * e.g. RX_IRQ_STAT after sendData(). The IRQs must have been cleared before
+ * the command was started.
+ *
+ * return value: the last IRQ-Status read, without any bit of irqMask set on timeout
+ */
+uint32_t PN5180::waitForIRQ(uint32_t irqMask, uint16_t timeoutMs) {
+  unsigned long start = millis();
+  uint32_t irqStatus = getIRQStatus();
+  while (0 == (irqStatus & irqMask)) {
+    if ((millis() - start) > timeoutMs) {
+      PN5180DEBUG(F("Timeout waiting for IRQ.\n"));
+      break;
+    }
+    irqStatus = getIRQStatus();
+  }
+  return irqStatus;
+}
+
+/*
+ * Default random source: the hardware TRNG where the platform has one
+ * (ESP32 with the RF subsystem running), false everywhere else. Other
+ * platforms must provide a source, e.g. an external TRNG or a secure element.
+ */
+bool PN5180::hardwareRandom(uint8_t *buffer, uint16_t len, void *context) {
+  (void)context;
+#if defined(ARDUINO_ARCH_ESP32)
+  esp_fill_random(buffer, len);
+  return true;
+#else
+  (void)buffer;
+  (void)len;
+  return false;
+#endif
+}
+
 /*
  * Get TRANSCEIVE_STATE from RF_STATUS register
  */
@@ -32,6 +32,7 @@
 #define RX_WAIT_CONFIG      (0x11)
 #define CRC_RX_CONFIG       (0x12)
 #define RX_STATUS           (0x13)
+#define TX_CONFIG           (0x18)
 #define CRC_TX_CONFIG       (0x19)
 #define RF_STATUS           (0x1d)
 #define SYSTEM_STATUS       (0x24)
@@ -65,6 +66,28 @@ enum PN5180TransceiveStat {
 #define TX_RFON_IRQ_STAT    (1<<9)  // RF Field ON in PCD IRQ
 #define RX_SOF_DET_IRQ_STAT (1<<14) // RF SOF Detection IRQ
 
+// PN5180 RX_STATUS
+#define RX_DATA_INTEGRITY_ERROR (1<<16)  // CRC or parity error
+#define RX_PROTOCOL_ERROR       (1<<17)  // framing error, e.g. missing SOF/EOF
+#define RX_COLLISION_DETECTED   (1<<18)  // collision in the received frame
+#define RX_NUM_FRAMES_RECEIVED(status) (((status) >> 9) & 0x0f)  // frames stored with RX_MULTIPLE_ENABLE
+
+// PN5180 TRANSCEIVE_CONTROL
+#define RX_MULTIPLE_ENABLE      (1<<4)   // keep receiving after a frame, one 32 byte chunk per frame
+
+/*
+ * Fills buffer with len bytes from a cryptographically secure source,
+ * returns false if none is available. Used for authentication challenges,
+ * Arduino random() is not suitable: it repeats the same sequence after every
+ * boot unless seeded.
+ */
+typedef bool (*PN5180RandomSource)(uint8_t *buffer, uint16_t len, void *context);
+
+// chips (distinct NSS pins) whose loaded RF configuration is tracked
+#ifndef PN5180_MAX_CHIPS
+#define PN5180_MAX_CHIPS 4
+#endif
+
 class PN5180 {
 private:
   uint8_t PN5180_NSS;   // active low
@@ -73,6 +96,12 @@ private:
 
   SPISettings PN5180_SPI_SETTINGS;
   static uint8_t readBuffer[508];
+  // RF configuration loaded last on each chip (TX, RX, 0xFF if unknown). The
+  // configuration belongs to the chip, so all objects on the same NSS pin share it.
+  static uint8_t numChips;
+  static uint8_t chipNss[PN5180_MAX_CHIPS];
+  static uint8_t chipRFConfig[PN5180_MAX_CHIPS][2];
+  uint8_t * activeRFConfig();
 
 public:
   PN5180(uint8_t SSpin, uint8_t BUSYpin, uint8_t RSTpin);
@@ -105,8 +134,12 @@ public:
   /* cmd 0x0a */
   uint8_t * readData(int len, uint8_t *buffer = NULL);
 
+  /* cmd 0x0c */
+  uint8_t mifareAuthenticate(uint8_t blockNo, const uint8_t *key, uint8_t keyType, const uint8_t *uid);
+
   /* cmd 0x11 */
   bool loadRFConfig(uint8_t txConf, uint8_t rxConf);
+  bool selectRFConfig(uint8_t txConf, uint8_t rxConf);
 
   /* cmd 0x16 */
   bool setRF_on();
@@ -121,6 +154,9 @@ public:
 
   uint32_t getIRQStatus();
   bool clearIRQStatus(uint32_t irqMask);
+  uint32_t waitForIRQ(uint32_t irqMask, uint16_t timeoutMs);
+
+  static bool hardwareRandom(uint8_t *buffer, uint16_t len, void *context);
 
   PN5180TransceiveStat getTransceiveState();
 
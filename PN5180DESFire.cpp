@@ -0,0 +1,769 @@
+// NAME: PN5180DESFire.cpp
+//
+// DESC: MIFARE DESFire EV1/EV2 native commands on top of the ISO-DEP transport
+//       of PN5180ISO14443.
+//
+// Copyright (c) 2026 by HOCC2011. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+//#define DEBUG 1
+
+#include <Arduino.h>
+#include "PN5180DESFire.h"
+#include "Debug.h"
+
+#define DESFIRE_KEY_AES             1
+#define DESFIRE_KEY_2K3DES          2
+
+#define DESFIRE_CMD_AUTHENTICATE_ISO  0x1A
+#define DESFIRE_CMD_AUTHENTICATE_AES  0xAA
+#define DESFIRE_CMD_SELECT_APPLICATION  0x5A
+#define DESFIRE_CMD_GET_APPLICATION_IDS 0x6A
+#define DESFIRE_CMD_GET_FILE_IDS    0x6F
+#define DESFIRE_CMD_READ_DATA       0xBD
+#define DESFIRE_CMD_READ_RECORDS    0xBB
+#define DESFIRE_CMD_GET_VALUE       0x6C
+#define DESFIRE_CMD_ADDITIONAL_FRAME  0xAF
+
+// largest frame a DESFire card sends, 59 data bytes plus status word
+#define DESFIRE_MAX_FRAME_SIZE      64
+// time the card needs to answer a native command, see exchangeApdu()
+#define DESFIRE_READ_DELAY          10
+#define DESFIRE_MAX_APPLICATIONS    28
+#define DESFIRE_MAX_FILES           32
+// length of the MAC appended to responses in MAC communication mode
+#define DESFIRE_MAC_LENGTH          8
+
+/*
+ * AES-128 (FIPS-197), byte oriented to keep it small on 8-bit controllers.
+ */
+static const uint8_t aesSbox[256] PROGMEM = {
+  0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+  0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+  0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+  0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+  0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+  0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+  0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+  0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+  0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+  0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+  0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+  0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+  0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+  0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+  0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+  0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+};
+
+static const uint8_t aesInvSbox[256] PROGMEM = {
+  0x52, 0x09, 0x6a, 0xd5, 0x30, 0x36, 0xa5, 0x38, 0xbf, 0x40, 0xa3, 0x9e, 0x81, 0xf3, 0xd7, 0xfb,
+  0x7c, 0xe3, 0x39, 0x82, 0x9b, 0x2f, 0xff, 0x87, 0x34, 0x8e, 0x43, 0x44, 0xc4, 0xde, 0xe9, 0xcb,
+  0x54, 0x7b, 0x94, 0x32, 0xa6, 0xc2, 0x23, 0x3d, 0xee, 0x4c, 0x95, 0x0b, 0x42, 0xfa, 0xc3, 0x4e,
+  0x08, 0x2e, 0xa1, 0x66, 0x28, 0xd9, 0x24, 0xb2, 0x76, 0x5b, 0xa2, 0x49, 0x6d, 0x8b, 0xd1, 0x25,
+  0x72, 0xf8, 0xf6, 0x64, 0x86, 0x68, 0x98, 0x16, 0xd4, 0xa4, 0x5c, 0xcc, 0x5d, 0x65, 0xb6, 0x92,
+  0x6c, 0x70, 0x48, 0x50, 0xfd, 0xed, 0xb9, 0xda, 0x5e, 0x15, 0x46, 0x57, 0xa7, 0x8d, 0x9d, 0x84,
+  0x90, 0xd8, 0xab, 0x00, 0x8c, 0xbc, 0xd3, 0x0a, 0xf7, 0xe4, 0x58, 0x05, 0xb8, 0xb3, 0x45, 0x06,
+  0xd0, 0x2c, 0x1e, 0x8f, 0xca, 0x3f, 0x0f, 0x02, 0xc1, 0xaf, 0xbd, 0x03, 0x01, 0x13, 0x8a, 0x6b,
+  0x3a, 0x91, 0x11, 0x41, 0x4f, 0x67, 0xdc, 0xea, 0x97, 0xf2, 0xcf, 0xce, 0xf0, 0xb4, 0xe6, 0x73,
+  0x96, 0xac, 0x74, 0x22, 0xe7, 0xad, 0x35, 0x85, 0xe2, 0xf9, 0x37, 0xe8, 0x1c, 0x75, 0xdf, 0x6e,
+  0x47, 0xf1, 0x1a, 0x71, 0x1d, 0x29, 0xc5, 0x89, 0x6f, 0xb7, 0x62, 0x0e, 0xaa, 0x18, 0xbe, 0x1b,
+  0xfc, 0x56, 0x3e, 0x4b, 0xc6, 0xd2, 0x79, 0x20, 0x9a, 0xdb, 0xc0, 0xfe, 0x78, 0xcd, 0x5a, 0xf4,
+  0x1f, 0xdd, 0xa8, 0x33, 0x88, 0x07, 0xc7, 0x31, 0xb1, 0x12, 0x10, 0x59, 0x27, 0x80, 0xec, 0x5f,
+  0x60, 0x51, 0x7f, 0xa9, 0x19, 0xb5, 0x4a, 0x0d, 0x2d, 0xe5, 0x7a, 0x9f, 0x93, 0xc9, 0x9c, 0xef,
+  0xa0, 0xe0, 0x3b, 0x4d, 0xae, 0x2a, 0xf5, 0xb0, 0xc8, 0xeb, 0xbb, 0x3c, 0x83, 0x53, 0x99, 0x61,
+  0x17, 0x2b, 0x04, 0x7e, 0xba, 0x77, 0xd6, 0x26, 0xe1, 0x69, 0x14, 0x63, 0x55, 0x21, 0x0c, 0x7d
+};
+
+static uint8_t aesXtime(uint8_t a) {
+  return (a << 1) ^ ((a & 0x80) ? 0x1b : 0x00);
+}
+
+static void aesExpandKey(const uint8_t *key, uint8_t *roundKeys) {
+  uint8_t rcon = 0x01;
+  memcpy(roundKeys, key, 16);
+  for (int i=16; i<176; i+=4) {
+    uint8_t t0 = roundKeys[i-4], t1 = roundKeys[i-3], t2 = roundKeys[i-2], t3 = roundKeys[i-1];
+    if (0 == (i % 16)) {
+      uint8_t tmp = t0;
+      t0 = pgm_read_byte(&aesSbox[t1]) ^ rcon;
+      t1 = pgm_read_byte(&aesSbox[t2]);
+      t2 = pgm_read_byte(&aesSbox[t3]);
+      t3 = pgm_read_byte(&aesSbox[tmp]);
+      rcon = aesXtime(rcon);
+    }
+    roundKeys[i]   = roundKeys[i-16] ^ t0;
+    roundKeys[i+1] = roundKeys[i-15] ^ t1;
+    roundKeys[i+2] = roundKeys[i-14] ^ t2;
+    roundKeys[i+3] = roundKeys[i-13] ^ t3;
+  }
+}
+
+static void aesAddRoundKey(uint8_t *state, const uint8_t *roundKey) {
+  for (int i=0; i<16; i++) {
+    state[i] ^= roundKey[i];
+  }
+}
+
+static void aesMixColumns(uint8_t *state) {
+  for (int c=0; c<16; c+=4) {
+    uint8_t a0 = state[c], a1 = state[c+1], a2 = state[c+2], a3 = state[c+3];
+    uint8_t t = a0 ^ a1 ^ a2 ^ a3;
+    state[c]   ^= t ^ aesXtime(a0 ^ a1);
+    state[c+1] ^= t ^ aesXtime(a1 ^ a2);
+    state[c+2] ^= t ^ aesXtime(a2 ^ a3);
+    state[c+3] ^= t ^ aesXtime(a3 ^ a0);
+  }
+}
+
+static void aesEncryptBlock(const uint8_t *roundKeys, uint8_t *block) {
+  uint8_t tmp[16];
+  aesAddRoundKey(block, roundKeys);
+  for (int round=1; round<=10; round++) {
+    // SubBytes and ShiftRows in one pass
+    for (int c=0; c<4; c++) {
+      for (int r=0; r<4; r++) {
+        tmp[c*4+r] = pgm_read_byte(&aesSbox[block[((c+r) & 3)*4+r]]);
+      }
+    }
+    memcpy(block, tmp, 16);
+    if (round < 10) {
+      aesMixColumns(block);
+    }
+    aesAddRoundKey(block, roundKeys + round*16);
+  }
+}
+
+static void aesDecryptBlock(const uint8_t *roundKeys, uint8_t *block) {
+  uint8_t tmp[16];
+  aesAddRoundKey(block, roundKeys + 160);
+  for (int round=9; round>=0; round--) {
+    // InvShiftRows and InvSubBytes in one pass
+    for (int c=0; c<4; c++) {
+      for (int r=0; r<4; r++) {
+        tmp[((c+r) & 3)*4+r] = pgm_read_byte(&aesInvSbox[block[c*4+r]]);
+      }
+    }
+    memcpy(block, tmp, 16);
+    aesAddRoundKey(block, roundKeys + round*16);
+    if (round > 0) {
+      // InvMixColumns = MixColumns after multiplying with {04}x^2 + {05}
+      for (int c=0; c<16; c+=4) {
+        uint8_t u = aesXtime(aesXtime(block[c] ^ block[c+2]));
+        uint8_t v = aesXtime(aesXtime(block[c+1] ^ block[c+3]));
+        block[c] ^= u;
+        block[c+1] ^= v;
+        block[c+2] ^= u;
+        block[c+3] ^= v;
+      }
+      aesMixColumns(block);
+    }
+  }
+}
+
+/*
+ * DES (FIPS 46-3), bit positions in the tables count from 1 at the MSB.
+ * Only used for 2K3DES, so speed is secondary to code size.
+ */
+static const uint8_t desIP[64] PROGMEM = {
+  58, 50, 42, 34, 26, 18, 10, 2, 60, 52, 44, 36, 28, 20, 12, 4,
+  62, 54, 46, 38, 30, 22, 14, 6, 64, 56, 48, 40, 32, 24, 16, 8,
+  57, 49, 41, 33, 25, 17,  9, 1, 59, 51, 43, 35, 27, 19, 11, 3,
+  61, 53, 45, 37, 29, 21, 13, 5, 63, 55, 47, 39, 31, 23, 15, 7
+};
+
+static const uint8_t desFP[64] PROGMEM = {
+  40, 8, 48, 16, 56, 24, 64, 32, 39, 7, 47, 15, 55, 23, 63, 31,
+  38, 6, 46, 14, 54, 22, 62, 30, 37, 5, 45, 13, 53, 21, 61, 29,
+  36, 4, 44, 12, 52, 20, 60, 28, 35, 3, 43, 11, 51, 19, 59, 27,
+  34, 2, 42, 10, 50, 18, 58, 26, 33, 1, 41,  9, 49, 17, 57, 25
+};
+
+static const uint8_t desE[48] PROGMEM = {
+  32,  1,  2,  3,  4,  5,  4,  5,  6,  7,  8,  9,
+   8,  9, 10, 11, 12, 13, 12, 13, 14, 15, 16, 17,
+  16, 17, 18, 19, 20, 21, 20, 21, 22, 23, 24, 25,
+  24, 25, 26, 27, 28, 29, 28, 29, 30, 31, 32,  1
+};
+
+static const uint8_t desP[32] PROGMEM = {
+  16,  7, 20, 21, 29, 12, 28, 17,  1, 15, 23, 26,  5, 18, 31, 10,
+   2,  8, 24, 14, 32, 27,  3,  9, 19, 13, 30,  6, 22, 11,  4, 25
+};
+
+static const uint8_t desPC1[56] PROGMEM = {
+  57, 49, 41, 33, 25, 17,  9,  1, 58, 50, 42, 34, 26, 18,
+  10,  2, 59, 51, 43, 35, 27, 19, 11,  3, 60, 52, 44, 36,
+  63, 55, 47, 39, 31, 23, 15,  7, 62, 54, 46, 38, 30, 22,
+  14,  6, 61, 53, 45, 37, 29, 21, 13,  5, 28, 20, 12,  4
+};
+
+static const uint8_t desPC2[48] PROGMEM = {
+  14, 17, 11, 24,  1,  5,  3, 28, 15,  6, 21, 10,
+  23, 19, 12,  4, 26,  8, 16,  7, 27, 20, 13,  2,
+  41, 52, 31, 37, 47, 55, 30, 40, 51, 45, 33, 48,
+  44, 49, 39, 56, 34, 53, 46, 42, 50, 36, 29, 32
+};
+
+static const uint8_t desShifts[16] PROGMEM = {
+  1, 1, 2, 2, 2, 2, 2, 2, 1, 2, 2, 2, 2, 2, 2, 1
+};
+
+static const uint8_t desSbox[8][64] PROGMEM = {
+  { 14,  4, 13,  1,  2, 15, 11,  8,  3, 10,  6, 12,  5,  9,  0,  7,
+     0, 15,  7,  4, 14,  2, 13,  1, 10,  6, 12, 11,  9,  5,  3,  8,
+     4,  1, 14,  8, 13,  6,  2, 11, 15, 12,  9,  7,  3, 10,  5,  0,
+    15, 12,  8,  2,  4,  9,  1,  7,  5, 11,  3, 14, 10,  0,  6, 13 },
+  { 15,  1,  8, 14,  6, 11,  3,  4,  9,  7,  2, 13, 12,  0,  5, 10,
+     3, 13,  4,  7, 15,  2,  8, 14, 12,  0,  1, 10,  6,  9, 11,  5,
+     0, 14,  7, 11, 10,  4, 13,  1,  5,  8, 12,  6,  9,  3,  2, 15,
+    13,  8, 10,  1,  3, 15,  4,  2, 11,  6,  7, 12,  0,  5, 14,  9 },
+  { 10,  0,  9, 14,  6,  3, 15,  5,  1, 13, 12,  7, 11,  4,  2,  8,
+    13,  7,  0,  9,  3,  4,  6, 10,  2,  8,  5, 14, 12, 11, 15,  1,
+    13,  6,  4,  9,  8, 15,  3,  0, 11,  1,  2, 12,  5, 10, 14,  7,
+     1, 10, 13,  0,  6,  9,  8,  7,  4, 15, 14,  3, 11,  5,  2, 12 },
+  {  7, 13, 14,  3,  0,  6,  9, 10,  1,  2,  8,  5, 11, 12,  4, 15,
+    13,  8, 11,  5,  6, 15,  0,  3,  4,  7,  2, 12,  1, 10, 14,  9,
+    10,  6,  9,  0, 12, 11,  7, 13, 15,  1,  3, 14,  5,  2,  8,  4,
+     3, 15,  0,  6, 10,  1, 13,  8,  9,  4,  5, 11, 12,  7,  2, 14 },
+  {  2, 12,  4,  1,  7, 10, 11,  6,  8,  5,  3, 15, 13,  0, 14,  9,
+    14, 11,  2, 12,  4,  7, 13,  1,  5,  0, 15, 10,  3,  9,  8,  6,
+     4,  2,  1, 11, 10, 13,  7,  8, 15,  9, 12,  5,  6,  3,  0, 14,
+    11,  8, 12,  7,  1, 14,  2, 13,  6, 15,  0,  9, 10,  4,  5,  3 },
+  { 12,  1, 10, 15,  9,  2,  6,  8,  0, 13,  3,  4, 14,  7,  5, 11,
+    10, 15,  4,  2,  7, 12,  9,  5,  6,  1, 13, 14,  0, 11,  3,  8,
+     9, 14, 15,  5,  2,  8, 12,  3,  7,  0,  4, 10,  1, 13, 11,  6,
+     4,  3,  2, 12,  9,  5, 15, 10, 11, 14,  1,  7,  6,  0,  8, 13 },
+  {  4, 11,  2, 14, 15,  0,  8, 13,  3, 12,  9,  7,  5, 10,  6,  1,
+    13,  0, 11,  7,  4,  9,  1, 10, 14,  3,  5, 12,  2, 15,  8,  6,
+     1,  4, 11, 13, 12,  3,  7, 14, 10, 15,  6,  8,  0,  5,  9,  2,
+     6, 11, 13,  8,  1,  4, 10,  7,  9,  5,  0, 15, 14,  2,  3, 12 },
+  { 13,  2,  8,  4,  6, 15, 11,  1, 10,  9,  3, 14,  5,  0, 12,  7,
+     1, 15, 13,  8, 10,  3,  7,  4, 12,  5,  6, 11,  0, 14,  9,  2,
+     7, 11,  4,  1,  9, 12, 14,  2,  0,  6, 10, 13, 15,  3,  5,  8,
+     2,  1, 14,  7,  4, 10,  8, 13, 15, 12,  9,  0,  3,  5,  6, 11 }
+};
+
+static uint64_t desPermute(uint64_t in, const uint8_t *table, uint8_t outBits, uint8_t inBits) {
+  uint64_t out = 0;
+  for (int i=0; i<outBits; i++) {
+    out = (out << 1) | ((in >> (inBits - pgm_read_byte(&table[i]))) & 1);
+  }
+  return out;
+}
+
+static uint64_t desLoad(const uint8_t *bytes) {
+  uint64_t value = 0;
+  for (int i=0; i<8; i++) {
+    value = (value << 8) | bytes[i];
+  }
+  return value;
+}
+
+static void desStore(uint64_t value, uint8_t *bytes) {
+  for (int i=7; i>=0; i--) {
+    bytes[i] = value & 0xFF;
+    value >>= 8;
+  }
+}
+
+// subkeys are stored as eight 6-bit groups, ready to be XORed into the S-box inputs
+static void desExpandKey(const uint8_t *key, uint8_t subkeys[16][8]) {
+  uint64_t cd = desPermute(desLoad(key), desPC1, 56, 64);
+  uint32_t c = (cd >> 28) & 0x0FFFFFFF;
+  uint32_t d = cd & 0x0FFFFFFF;
+  for (int round=0; round<16; round++) {
+    uint8_t shift = pgm_read_byte(&desShifts[round]);
+    c = ((c << shift) | (c >> (28 - shift))) & 0x0FFFFFFF;
+    d = ((d << shift) | (d >> (28 - shift))) & 0x0FFFFFFF;
+    uint64_t k = desPermute(((uint64_t)c << 28) | d, desPC2, 48, 56);
+    for (int j=0; j<8; j++) {
+      subkeys[round][j] = (k >> (42 - 6*j)) & 0x3F;
+    }
+  }
+}
+
+static void desCryptBlock(const uint8_t subkeys[16][8], uint8_t *block, bool decrypt) {
+  uint64_t lr = desPermute(desLoad(block), desIP, 64, 64);
+  uint32_t l = lr >> 32;
+  uint32_t r = lr & 0xFFFFFFFF;
+  for (int round=0; round<16; round++) {
+    const uint8_t *k = subkeys[decrypt ? (15 - round) : round];
+    uint64_t e = desPermute(r, desE, 48, 32);
+    uint32_t s = 0;
+    for (int j=0; j<8; j++) {
+      uint8_t six = ((e >> (42 - 6*j)) & 0x3F) ^ k[j];
+      uint8_t index = (six & 0x20) | ((six & 0x01) << 4) | ((six >> 1) & 0x0F);
+      s = (s << 4) | pgm_read_byte(&desSbox[j][index]);
+    }
+    uint32_t f = desPermute(s, desP, 32, 32);
+    uint32_t tmp = r;
+    r = l ^ f;
+    l = tmp;
+  }
+  desStore(desPermute(((uint64_t)r << 32) | l, desFP, 64, 64), block);
+}
+
+/*
+ * Block cipher dispatch for the key types in use. 2K3DES is EDE with K1, K2, K1.
+ */
+static void expandKey(uint8_t keyType, const uint8_t *key, DESFireKeySchedule *schedule) {
+  if (DESFIRE_KEY_AES == keyType) {
+    aesExpandKey(key, schedule->aes);
+  }
+  else {
+    desExpandKey(key, schedule->des[0]);
+    desExpandKey(key + 8, schedule->des[1]);
+  }
+}
+
+static void encryptBlock(uint8_t keyType, const DESFireKeySchedule *schedule, uint8_t *block) {
+  if (DESFIRE_KEY_AES == keyType) {
+    aesEncryptBlock(schedule->aes, block);
+  }
+  else {
+    desCryptBlock(schedule->des[0], block, false);
+    desCryptBlock(schedule->des[1], block, true);
+    desCryptBlock(schedule->des[0], block, false);
+  }
+}
+
+static void decryptBlock(uint8_t keyType, const DESFireKeySchedule *schedule, uint8_t *block) {
+  if (DESFIRE_KEY_AES == keyType) {
+    aesDecryptBlock(schedule->aes, block);
+  }
+  else {
+    desCryptBlock(schedule->des[0], block, true);
+    desCryptBlock(schedule->des[1], block, false);
+    desCryptBlock(schedule->des[0], block, true);
+  }
+}
+
+// CBC in place, iv is updated to the last ciphertext block for chaining
+static void cbcEncrypt(uint8_t keyType, const DESFireKeySchedule *schedule, uint8_t blockSize, uint8_t *iv, uint8_t *data, uint8_t len) {
+  for (int pos=0; pos<len; pos+=blockSize) {
+    for (int i=0; i<blockSize; i++) {
+      data[pos+i] ^= iv[i];
+    }
+    encryptBlock(keyType, schedule, data + pos);
+    memcpy(iv, data + pos, blockSize);
+  }
+}
+
+static void cbcDecrypt(uint8_t keyType, const DESFireKeySchedule *schedule, uint8_t blockSize, uint8_t *iv, uint8_t *data, uint8_t len) {
+  uint8_t cipherText[16];
+  for (int pos=0; pos<len; pos+=blockSize) {
+    memcpy(cipherText, data + pos, blockSize);
+    decryptBlock(keyType, schedule, data + pos);
+    for (int i=0; i<blockSize; i++) {
+      data[pos+i] ^= iv[i];
+    }
+    memcpy(iv, cipherText, blockSize);
+  }
+}
+
+// rotate left by one byte, RndA' and RndB' of the authentication
+static void rotateLeft(uint8_t *dst, const uint8_t *src, uint8_t len) {
+  for (int i=0; i<len; i++) {
+    dst[i] = src[(i + 1) % len];
+  }
+}
+
+// K1 = L << 1 and K2 = K1 << 1, XORed with Rb on carry out
+static void cmacSubkey(uint8_t *dst, const uint8_t *src, uint8_t blockSize) {
+  uint8_t rb = (16 == blockSize) ? 0x87 : 0x1B;
+  bool msb = src[0] & 0x80;
+  for (int i=0; i<blockSize-1; i++) {
+    dst[i] = (src[i] << 1) | (src[i+1] >> 7);
+  }
+  dst[blockSize-1] = (src[blockSize-1] << 1) ^ (msb ? rb : 0x00);
+}
+
+PN5180DESFire::PN5180DESFire(uint8_t SSpin, uint8_t BUSYpin, uint8_t RSTpin)
+              : PN5180ISO14443(SSpin, BUSYpin, RSTpin) {
+  resetAuthentication();
+}
+
+/*
+ * Drop the session state. The card does the same on any error,
+ * on SelectApplication and on a new authentication.
+ */
+void PN5180DESFire::resetAuthentication() {
+  authKeyType = 0;
+  cipherBlockSize = 0;
+  memset(&sessionSchedule, 0, sizeof(sessionSchedule));
+  memset(sessionIV, 0, sizeof(sessionIV));
+  memset(cmacK1, 0, sizeof(cmacK1));
+  memset(cmacK2, 0, sizeof(cmacK2));
+}
+
+bool PN5180DESFire::isAuthenticated() {
+  return (0 != authKeyType);
+}
+
+/*
+ * CMAC (NIST SP 800-38B) over msg || trailer with the session key, chained
+ * through the session IV as EV1 secure messaging requires. The full CMAC
+ * becomes the new IV, the card transmits its first 8 bytes.
+ */
+void PN5180DESFire::cmac(const uint8_t *msg, uint16_t msgLen, const uint8_t *trailer, uint8_t trailerLen, uint8_t *mac) {
+  uint8_t blockSize = cipherBlockSize;
+  uint16_t total = msgLen + trailerLen;
+  uint16_t numBlocks = (total + blockSize - 1) / blockSize;
+  if (0 == numBlocks) {
+    numBlocks = 1;
+  }
+  bool complete = (total > 0) && (0 == (total % blockSize));
+
+  uint16_t pos = 0;
+  for (uint16_t block=0; block<numBlocks; block++) {
+    bool last = (block == numBlocks - 1);
+    for (int i=0; i<blockSize; i++, pos++) {
+      uint8_t b;
+      if (pos < msgLen) b = msg[pos];
+      else if (pos < total) b = trailer[pos - msgLen];
+      else if (pos == total) b = 0x80;
+      else b = 0x00;
+      if (last) {
+        b ^= complete ? cmacK1[i] : cmacK2[i];
+      }
+      sessionIV[i] ^= b;
+    }
+    encryptBlock(authKeyType, &sessionSchedule, sessionIV);
+  }
+  memcpy(mac, sessionIV, blockSize);
+}
+
+/*
+ * Exchange a single native command frame, wrapped in an ISO7816 APDU:
+ * 90 <cmd> 00 00 [Lc <data>] 00. The card answers <data> 91 <status>.
+ */
+DESFireErrorCode PN5180DESFire::frame(uint8_t cmd, const uint8_t *data, uint8_t dataLen, uint8_t *response, uint16_t maxResponseLen, uint16_t *responseLen) {
+  *responseLen = 0;
+
+  uint8_t apdu[dataLen + 6];
+  uint8_t apduLen = 0;
+  apdu[apduLen++] = 0x90;
+  apdu[apduLen++] = cmd;
+  apdu[apduLen++] = 0x00;
+  apdu[apduLen++] = 0x00;
+  if (dataLen > 0) {
+    apdu[apduLen++] = dataLen;
+    memcpy(&apdu[apduLen], data, dataLen);
+    apduLen += dataLen;
+  }
+  apdu[apduLen++] = 0x00;
+
+  // room for the ISO-DEP prologue in front of the frame
+  uint8_t rx[DESFIRE_MAX_FRAME_SIZE + 8];
+  uint16_t len = exchangeApdu(apdu, apduLen, rx, sizeof(rx), DESFIRE_READ_DELAY);
+  if (len < 2) {
+    PN5180DEBUG(F("DESFire: no response\n"));
+    return DESFIRE_EC_NO_CARD;
+  }
+  if (0x91 != rx[len-2]) {
+    PN5180DEBUG(F("DESFire: unexpected status word\n"));
+    return DESFIRE_EC_ILLEGAL_COMMAND;
+  }
+
+  len -= 2;
+  if (len > maxResponseLen) {
+    return DESFIRE_EC_BUFFER_TOO_SMALL;
+  }
+  memcpy(response, rx, len);
+  *responseLen = len;
+  return (DESFireErrorCode)rx[len+1];
+}
+
+/*
+ * Send a native command and collect the complete response. While the card
+ * answers with status 0xAF, the next part is requested with an
+ * ADDITIONAL_FRAME command and appended to the response buffer.
+ *
+ * After an AES or ISO authentication every command and response is fed
+ * through the CMAC to keep the IV in sync with the card. In MAC
+ * communication mode the 8 MAC bytes at the end of the response are
+ * checked and removed, so the buffer has to provide room for them.
+ */
+DESFireErrorCode PN5180DESFire::command(uint8_t cmd, const uint8_t *data, uint8_t dataLen, uint8_t *response, uint16_t maxResponseLen, uint16_t *responseLen, DESFireCommMode commMode) {
+  *responseLen = 0;
+  if ((DESFIRE_COMM_MAC == commMode) && !isAuthenticated()) {
+    return DESFIRE_EC_AUTHENTICATION_ERROR;
+  }
+
+  uint8_t mac[16];
+  if (isAuthenticated()) {
+    cmac(&cmd, 1, data, dataLen, mac);
+  }
+
+  uint16_t received = 0;
+  DESFireErrorCode rc;
+  for (;;) {
+    uint16_t frameLen;
+    rc = frame(cmd, data, dataLen, response + received, maxResponseLen - received, &frameLen);
+    received += frameLen;
+    if (DESFIRE_EC_ADDITIONAL_FRAME != rc) {
+      break;
+    }
+    cmd = DESFIRE_CMD_ADDITIONAL_FRAME;
+    data = NULL;
+    dataLen = 0;
+  }
+
+  if (DESFIRE_EC_OK != rc) {
+    PN5180DEBUG(F("DESFire: "));
+    PN5180DEBUG(strerror(rc));
+    PN5180DEBUG(F("\n"));
+    resetAuthentication();
+    return rc;
+  }
+
+  if (isAuthenticated()) {
+    uint8_t status = DESFIRE_EC_OK;
+    if (DESFIRE_COMM_MAC == commMode) {
+      if (received < DESFIRE_MAC_LENGTH) {
+        resetAuthentication();
+        return DESFIRE_EC_MAC_ERROR;
+      }
+      received -= DESFIRE_MAC_LENGTH;
+      cmac(response, received, &status, 1, mac);
+      if (0 != memcmp(mac, response + received, DESFIRE_MAC_LENGTH)) {
+        PN5180DEBUG(F("DESFire: MAC mismatch\n"));
+        resetAuthentication();
+        return DESFIRE_EC_MAC_ERROR;
+      }
+    }
+    else {
+      cmac(response, received, &status, 1, mac);
+    }
+  }
+
+  *responseLen = received;
+  return DESFIRE_EC_OK;
+}
+
+/*
+ * Mutual three pass authentication, native AES (0xAA) or ISO (0x1A) with 2K3DES.
+ *   card -> ek(RndB)
+ *   ek(RndA || RndB') -> card, RndB' is RndB rotated left by one byte
+ *   card -> ek(RndA')
+ * CBC runs across all three messages. The session key schedule and the CMAC
+ * subkeys are derived once here and reused by every following command.
+ */
+DESFireErrorCode PN5180DESFire::authenticate(uint8_t authCmd, uint8_t keyType, uint8_t keyNo, const uint8_t *key) {
+  resetAuthentication();
+
+  uint8_t blockSize = (DESFIRE_KEY_AES == keyType) ? 16 : 8;
+  uint8_t rndA[16];
+  if ((NULL == randomSource) || !randomSource(rndA, blockSize, randomContext)) {
+    PN5180DEBUG(F("DESFire: no random source for RndA\n"));
+    return DESFIRE_EC_NO_RANDOM_SOURCE;
+  }
+
+  DESFireKeySchedule keySchedule;
+  expandKey(keyType, key, &keySchedule);
+
+  uint8_t iv[16];
+  memset(iv, 0, sizeof(iv));
+
+  uint8_t rndB[16];
+  uint16_t len;
+  DESFireErrorCode rc = frame(authCmd, &keyNo, 1, rndB, sizeof(rndB), &len);
+  if (DESFIRE_EC_ADDITIONAL_FRAME != rc) {
+    return (DESFIRE_EC_OK == rc) ? DESFIRE_EC_AUTHENTICATION_ERROR : rc;
+  }
+  if (len != blockSize) {
+    return DESFIRE_EC_AUTHENTICATION_ERROR;
+  }
+  cbcDecrypt(keyType, &keySchedule, blockSize, iv, rndB, blockSize);
+
+  uint8_t token[32];
+  memcpy(token, rndA, blockSize);
+  rotateLeft(token + blockSize, rndB, blockSize);
+  cbcEncrypt(keyType, &keySchedule, blockSize, iv, token, 2*blockSize);
+
+  uint8_t rndAEnc[16];
+  rc = frame(DESFIRE_CMD_ADDITIONAL_FRAME, token, 2*blockSize, rndAEnc, sizeof(rndAEnc), &len);
+  if (DESFIRE_EC_OK != rc) {
+    return rc;
+  }
+  if (len != blockSize) {
+    return DESFIRE_EC_AUTHENTICATION_ERROR;
+  }
+  cbcDecrypt(keyType, &keySchedule, blockSize, iv, rndAEnc, blockSize);
+
+  uint8_t expected[16];
+  rotateLeft(expected, rndA, blockSize);
+  if (0 != memcmp(expected, rndAEnc, blockSize)) {
+    PN5180DEBUG(F("DESFire: card failed to prove the key\n"));
+    return DESFIRE_EC_AUTHENTICATION_ERROR;
+  }
+
+  // AES:    RndA[0..3] RndB[0..3] RndA[12..15] RndB[12..15]
+  // 2K3DES: RndA[0..3] RndB[0..3] RndA[4..7] RndB[4..7], K2 = K1 for a single DES key
+  uint8_t sessionKey[16];
+  uint8_t tail = (DESFIRE_KEY_AES == keyType) ? 12 : 4;
+  memcpy(sessionKey, rndA, 4);
+  memcpy(sessionKey + 4, rndB, 4);
+  memcpy(sessionKey + 8, rndA + tail, 4);
+  memcpy(sessionKey + 12, rndB + tail, 4);
+  if ((DESFIRE_KEY_2K3DES == keyType) && (0 == memcmp(key, key + 8, 8))) {
+    memcpy(sessionKey + 8, sessionKey, 8);
+  }
+
+  authKeyType = keyType;
+  cipherBlockSize = blockSize;
+  expandKey(keyType, sessionKey, &sessionSchedule);
+  memset(sessionIV, 0, sizeof(sessionIV));
+
+  uint8_t l[16];
+  memset(l, 0, sizeof(l));
+  encryptBlock(keyType, &sessionSchedule, l);
+  cmacSubkey(cmacK1, l, blockSize);
+  cmacSubkey(cmacK2, cmacK1, blockSize);
+
+  memset(&keySchedule, 0, sizeof(keySchedule));
+  memset(sessionKey, 0, sizeof(sessionKey));
+  memset(rndA, 0, sizeof(rndA));
+  return DESFIRE_EC_OK;
+}
+
+/*
+ * Source of RndA. Defaults to the hardware TRNG on ESP32, on other platforms
+ * authentication fails with DESFIRE_EC_NO_RANDOM_SOURCE until one is set.
+ */
+void PN5180DESFire::setRandomSource(PN5180RandomSource source, void *context) {
+  randomSource = source;
+  randomContext = context;
+}
+
+DESFireErrorCode PN5180DESFire::authenticateAES(uint8_t keyNo, const uint8_t *key) {
+  PN5180DEBUG(F("DESFire: AES authentication...\n"));
+  return authenticate(DESFIRE_CMD_AUTHENTICATE_AES, DESFIRE_KEY_AES, keyNo, key);
+}
+
+/*
+ * key is 16 bytes K1 || K2, a single DES key is given as K1 || K1.
+ */
+DESFireErrorCode PN5180DESFire::authenticate2K3DES(uint8_t keyNo, const uint8_t *key) {
+  PN5180DEBUG(F("DESFire: 2K3DES authentication...\n"));
+  return authenticate(DESFIRE_CMD_AUTHENTICATE_ISO, DESFIRE_KEY_2K3DES, keyNo, key);
+}
+
+/*
+ * AIDs are 3 bytes, transmitted LSB first.
+ */
+DESFireErrorCode PN5180DESFire::getApplicationIDs(uint32_t *aids, uint8_t maxAids, uint8_t *numAids) {
+  *numAids = 0;
+  uint8_t response[DESFIRE_MAX_APPLICATIONS*3 + DESFIRE_MAX_FRAME_SIZE];
+  uint16_t len;
+  DESFireErrorCode rc = command(DESFIRE_CMD_GET_APPLICATION_IDS, NULL, 0, response, sizeof(response), &len);
+  if (DESFIRE_EC_OK != rc) {
+    return rc;
+  }
+  for (int pos=0; (pos+3 <= len) && (*numAids < maxAids); pos+=3) {
+    aids[(*numAids)++] = (uint32_t)response[pos] | ((uint32_t)response[pos+1] << 8) | ((uint32_t)response[pos+2] << 16);
+  }
+  return DESFIRE_EC_OK;
+}
+
+DESFireErrorCode PN5180DESFire::selectApplication(uint32_t aid) {
+  uint8_t data[3] = { (uint8_t)aid, (uint8_t)(aid >> 8), (uint8_t)(aid >> 16) };
+  uint16_t len;
+  DESFireErrorCode rc = command(DESFIRE_CMD_SELECT_APPLICATION, data, sizeof(data), NULL, 0, &len);
+  // selecting an application always ends the authenticated state
+  resetAuthentication();
+  return rc;
+}
+
+DESFireErrorCode PN5180DESFire::getFileIDs(uint8_t *fileIds, uint8_t maxFiles, uint8_t *numFiles) {
+  *numFiles = 0;
+  uint8_t response[DESFIRE_MAX_FILES + DESFIRE_MAX_FRAME_SIZE];
+  uint16_t len;
+  DESFireErrorCode rc = command(DESFIRE_CMD_GET_FILE_IDS, NULL, 0, response, sizeof(response), &len);
+  if (DESFIRE_EC_OK != rc) {
+    return rc;
+  }
+  for (int i=0; (i < len) && (*numFiles < maxFiles); i++) {
+    fileIds[(*numFiles)++] = response[i];
+  }
+  return DESFIRE_EC_OK;
+}
+
+/*
+ * Read a data file (standard or backup). offset and length are limited to
+ * 24 bits, length 0 reads up to the end of the file. In MAC mode maxLen has
+ * to include 8 extra bytes for the MAC, which is removed from the result.
+ */
+DESFireErrorCode PN5180DESFire::readFileData(uint8_t fileNo, uint32_t offset, uint32_t length, uint8_t *buffer, uint16_t maxLen, uint16_t *readLen, DESFireCommMode commMode) {
+  uint8_t data[7] = {
+    fileNo,
+    (uint8_t)offset, (uint8_t)(offset >> 8), (uint8_t)(offset >> 16),
+    (uint8_t)length, (uint8_t)(length >> 8), (uint8_t)(length >> 16)
+  };
+  return command(DESFIRE_CMD_READ_DATA, data, sizeof(data), buffer, maxLen, readLen, commMode);
+}
+
+/*
+ * Read records of a linear or cyclic record file, starting with the newest
+ * record at firstRecord 0. numRecords 0 reads all records.
+ */
+DESFireErrorCode PN5180DESFire::readRecords(uint8_t fileNo, uint32_t firstRecord, uint32_t numRecords, uint8_t *buffer, uint16_t maxLen, uint16_t *readLen, DESFireCommMode commMode) {
+  uint8_t data[7] = {
+    fileNo,
+    (uint8_t)firstRecord, (uint8_t)(firstRecord >> 8), (uint8_t)(firstRecord >> 16),
+    (uint8_t)numRecords, (uint8_t)(numRecords >> 8), (uint8_t)(numRecords >> 16)
+  };
+  return command(DESFIRE_CMD_READ_RECORDS, data, sizeof(data), buffer, maxLen, readLen, commMode);
+}
+
+DESFireErrorCode PN5180DESFire::getValue(uint8_t fileNo, int32_t *value, DESFireCommMode commMode) {
+  uint8_t response[4 + DESFIRE_MAC_LENGTH];
+  uint16_t len;
+  DESFireErrorCode rc = command(DESFIRE_CMD_GET_VALUE, &fileNo, 1, response, sizeof(response), &len, commMode);
+  if (DESFIRE_EC_OK != rc) {
+    return rc;
+  }
+  if (4 != len) {
+    return DESFIRE_EC_LENGTH_ERROR;
+  }
+  *value = (int32_t)((uint32_t)response[0] | ((uint32_t)response[1] << 8) | ((uint32_t)response[2] << 16) | ((uint32_t)response[3] << 24));
+  return DESFIRE_EC_OK;
+}
+
+const __FlashStringHelper *PN5180DESFire::strerror(DESFireErrorCode errno) {
+  switch (errno) {
+    case DESFIRE_EC_NO_CARD: return F("No card detected!");
+    case DESFIRE_EC_OK: return F("OK!");
+    case DESFIRE_EC_NO_CHANGES: return F("No changes done to backup files!");
+    case DESFIRE_EC_OUT_OF_MEMORY: return F("Insufficient NV-Memory!");
+    case DESFIRE_EC_ILLEGAL_COMMAND: return F("Command code not supported!");
+    case DESFIRE_EC_INTEGRITY_ERROR: return F("CRC or MAC does not match data!");
+    case DESFIRE_EC_NO_SUCH_KEY: return F("Invalid key number specified!");
+    case DESFIRE_EC_LENGTH_ERROR: return F("Length of command string invalid!");
+    case DESFIRE_EC_PERMISSION_DENIED: return F("Permission denied!");
+    case DESFIRE_EC_PARAMETER_ERROR: return F("Value of the parameter(s) invalid!");
+    case DESFIRE_EC_APPLICATION_NOT_FOUND: return F("Requested AID not present on PICC!");
+    case DESFIRE_EC_AUTHENTICATION_ERROR: return F("Authentication error!");
+    case DESFIRE_EC_ADDITIONAL_FRAME: return F("Additional data frame is expected!");
+    case DESFIRE_EC_BOUNDARY_ERROR: return F("Attempt to read/write beyond the file's limits!");
+    case DESFIRE_EC_COMMAND_ABORTED: return F("Previous command was not fully completed!");
+    case DESFIRE_EC_FILE_NOT_FOUND: return F("Specified file number does not exist!");
+    case DESFIRE_EC_BUFFER_TOO_SMALL: return F("Response does not fit into the buffer!");
+    case DESFIRE_EC_MAC_ERROR: return F("MAC of the response does not match!");
+    case DESFIRE_EC_NO_RANDOM_SOURCE: return F("No random source for authentication!");
+    default:
+      return F("Undefined error code in DESFire!");
+  }
+}
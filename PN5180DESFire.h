@@ -0,0 +1,99 @@
+// NAME: PN5180DESFire.h
+//
+// DESC: MIFARE DESFire EV1/EV2 native commands on top of the ISO-DEP transport
+//       of PN5180ISO14443.
+//
+// Copyright (c) 2026 by HOCC2011. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+#ifndef PN5180DESFIRE_H
+#define PN5180DESFIRE_H
+
+#include "PN5180ISO14443.h"
+
+enum DESFireErrorCode {
+  DESFIRE_EC_NO_CARD = -1,
+  DESFIRE_EC_OK = 0x00,
+  DESFIRE_EC_NO_CHANGES = 0x0C,
+  DESFIRE_EC_OUT_OF_MEMORY = 0x0E,
+  DESFIRE_EC_ILLEGAL_COMMAND = 0x1C,
+  DESFIRE_EC_INTEGRITY_ERROR = 0x1E,
+  DESFIRE_EC_NO_SUCH_KEY = 0x40,
+  DESFIRE_EC_LENGTH_ERROR = 0x7E,
+  DESFIRE_EC_PERMISSION_DENIED = 0x9D,
+  DESFIRE_EC_PARAMETER_ERROR = 0x9E,
+  DESFIRE_EC_APPLICATION_NOT_FOUND = 0xA0,
+  DESFIRE_EC_AUTHENTICATION_ERROR = 0xAE,
+  DESFIRE_EC_ADDITIONAL_FRAME = 0xAF,
+  DESFIRE_EC_BOUNDARY_ERROR = 0xBE,
+  DESFIRE_EC_COMMAND_ABORTED = 0xCA,
+  DESFIRE_EC_FILE_NOT_FOUND = 0xF0,
+  // library errors, not sent by the card
+  DESFIRE_EC_BUFFER_TOO_SMALL = 0x100,
+  DESFIRE_EC_MAC_ERROR = 0x101,
+  DESFIRE_EC_NO_RANDOM_SOURCE = 0x102
+};
+
+// communication mode of a file, enciphered files are not supported
+enum DESFireCommMode {
+  DESFIRE_COMM_PLAIN = 0,
+  DESFIRE_COMM_MAC = 1
+};
+
+// expanded key of the cipher in use, AES-128 round keys or the
+// 6-bit grouped DES subkeys of K1 and K2 for 2K3DES
+union DESFireKeySchedule {
+  uint8_t aes[176];
+  uint8_t des[2][16][8];
+};
+
+class PN5180DESFire : public PN5180ISO14443 {
+
+public:
+  PN5180DESFire(uint8_t SSpin, uint8_t BUSYpin, uint8_t RSTpin);
+
+private:
+  // session established by the last successful authentication
+  uint8_t authKeyType = 0;      // 0 = not authenticated, else DESFIRE_KEY_AES / DESFIRE_KEY_2K3DES
+  uint8_t cipherBlockSize = 0;  // 16 for AES, 8 for 2K3DES
+  DESFireKeySchedule sessionSchedule;
+  uint8_t sessionIV[16];
+  uint8_t cmacK1[16];
+  uint8_t cmacK2[16];
+  PN5180RandomSource randomSource = PN5180::hardwareRandom;
+  void *randomContext = NULL;
+
+  DESFireErrorCode frame(uint8_t cmd, const uint8_t *data, uint8_t dataLen, uint8_t *response, uint16_t maxResponseLen, uint16_t *responseLen);
+  DESFireErrorCode command(uint8_t cmd, const uint8_t *data, uint8_t dataLen, uint8_t *response, uint16_t maxResponseLen, uint16_t *responseLen, DESFireCommMode commMode = DESFIRE_COMM_PLAIN);
+  DESFireErrorCode authenticate(uint8_t authCmd, uint8_t keyType, uint8_t keyNo, const uint8_t *key);
+  void cmac(const uint8_t *msg, uint16_t msgLen, const uint8_t *trailer, uint8_t trailerLen, uint8_t *mac);
+  void resetAuthentication();
+
+public:
+  DESFireErrorCode getApplicationIDs(uint32_t *aids, uint8_t maxAids, uint8_t *numAids);
+  DESFireErrorCode selectApplication(uint32_t aid);
+  DESFireErrorCode getFileIDs(uint8_t *fileIds, uint8_t maxFiles, uint8_t *numFiles);
+  DESFireErrorCode readFileData(uint8_t fileNo, uint32_t offset, uint32_t length, uint8_t *buffer, uint16_t maxLen, uint16_t *readLen, DESFireCommMode commMode = DESFIRE_COMM_PLAIN);
+  DESFireErrorCode readRecords(uint8_t fileNo, uint32_t firstRecord, uint32_t numRecords, uint8_t *buffer, uint16_t maxLen, uint16_t *readLen, DESFireCommMode commMode = DESFIRE_COMM_PLAIN);
+  DESFireErrorCode getValue(uint8_t fileNo, int32_t *value, DESFireCommMode commMode = DESFIRE_COMM_PLAIN);
+
+  DESFireErrorCode authenticateAES(uint8_t keyNo, const uint8_t *key);
+  DESFireErrorCode authenticate2K3DES(uint8_t keyNo, const uint8_t *key);
+  bool isAuthenticated();
+  void setRandomSource(PN5180RandomSource source, void *context = NULL);
+
+  const __FlashStringHelper *strerror(DESFireErrorCode errno);
+};
+
+#endif /* PN5180DESFIRE_H */
@@ -0,0 +1,337 @@
+// NAME: PN5180EMV.cpp
+//
+// DESC: Read-only EMV contactless data collection (PPSE, SELECT, GPO,
+//       READ RECORD) on top of the ISO-DEP transport of PN5180ISO14443.
+//
+// Copyright (c) 2026 by HOCC2011. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+//#define DEBUG 1
+
+#include <Arduino.h>
+#include "PN5180EMV.h"
+#include "PN5180TLV.h"
+#include "Debug.h"
+
+// card processing time before the answer is read, see exchangeApdu()
+#define EMV_SELECT_DELAY        10
+#define EMV_GPO_DELAY           30
+#define EMV_READ_RECORD_DELAY   10
+
+#define EMV_MAX_PDOL_DATA       64
+#define EMV_MAX_TLV_DEPTH       4
+
+PN5180EMV::PN5180EMV(PN5180ISO14443 &reader) {
+  this->reader = &reader;
+  arena = NULL;
+  arenaSize = 0;
+  arenaUsed = 0;
+  card = NULL;
+  randomSource = PN5180::hardwareRandom;
+  randomContext = NULL;
+}
+
+/*
+ * Source of the unpredictable number (9F37) in the PDOL. Defaults to the
+ * hardware TRNG on ESP32, on other platforms GPO fails for cards asking for
+ * 9F37 until one is set.
+ */
+void PN5180EMV::setRandomSource(PN5180RandomSource source, void *context) {
+  randomSource = source;
+  randomContext = context;
+}
+
+/*
+ * Exchange one command, the response is appended to the arena and stays there.
+ * 61xx is followed by GET RESPONSE, 6Cxx repeats the command with the Le given
+ * by the card (the last byte of every APDU sent here is Le).
+ *
+ * return value: true for status 9000, response excludes the status word
+ */
+bool PN5180EMV::transmit(uint8_t *apdu, uint8_t apduLen, uint8_t readDelay, const uint8_t **response, uint16_t *responseLen) {
+  uint8_t *buffer = arena + arenaUsed;
+  uint16_t maxLen = arenaSize - arenaUsed;
+  uint16_t len = reader->exchangeApdu(apdu, apduLen, buffer, maxLen, readDelay);
+  if (len < 2) {
+    return false;
+  }
+
+  if (0x6C == buffer[len-2]) {
+    apdu[apduLen-1] = buffer[len-1];
+    len = reader->exchangeApdu(apdu, apduLen, buffer, maxLen, readDelay);
+  }
+  else if (0x61 == buffer[len-2]) {
+    uint8_t getResponse[5] = { 0x00, 0xC0, 0x00, 0x00, buffer[len-1] };
+    len = reader->exchangeApdu(getResponse, sizeof(getResponse), buffer, maxLen, readDelay);
+  }
+  if ((len < 2) || (0x90 != buffer[len-2]) || (0x00 != buffer[len-1])) {
+    PN5180DEBUG(F("EMV: command failed\n"));
+    return false;
+  }
+
+  *response = buffer;
+  *responseLen = len - 2;
+  arenaUsed += len - 2;
+  return true;
+}
+
+/*
+ * Pick up the tags of interest from a response, the first occurrence wins.
+ */
+void PN5180EMV::collectTags(const uint8_t *data, uint16_t len, uint8_t depth) {
+  BerTlvParser parser(data, len);
+  BerTlv tlv;
+  while (parser.next(&tlv)) {
+    if (tlv.constructed) {
+      if (depth < EMV_MAX_TLV_DEPTH) {
+        collectTags(tlv.value, tlv.length, depth + 1);
+      }
+      continue;
+    }
+
+    EmvTagView *view = NULL;
+    switch (tlv.tag) {
+      case 0x50:   view = &card->label; break;
+      case 0x9F12: view = &card->preferredName; break;
+      case 0x5A:   view = &card->pan; break;
+      case 0x5F24: view = &card->expiry; break;
+      case 0x57:   view = &card->track2; break;
+      case 0x5F20: view = &card->cardholderName; break;
+      case 0x9F38: view = &pdol; break;
+      case 0x94:   view = &afl; break;
+    }
+    if ((NULL != view) && (0 == view->length)) {
+      view->value = tlv.value;
+      view->length = tlv.length;
+    }
+  }
+}
+
+/*
+ * Identification is complete with PAN and expiry (or track 2, which holds
+ * both) and a name for the application. No further records are read then.
+ */
+bool PN5180EMV::isComplete() {
+  bool panAndExpiry = ((0 != card->pan.length) && (0 != card->expiry.length)) || (0 != card->track2.length);
+  bool name = (0 != card->label.length) || (0 != card->preferredName.length);
+  return panAndExpiry && name;
+}
+
+/*
+ * SELECT 2PAY.SYS.DDF01 and take the application with the highest priority
+ * (lowest value in tag 87) from the directory 6F/A5/BF0C/61.
+ */
+bool PN5180EMV::selectPpse() {
+  uint8_t apdu[] = { 0x00, 0xA4, 0x04, 0x00, 0x0E,
+                     '2', 'P', 'A', 'Y', '.', 'S', 'Y', 'S', '.', 'D', 'D', 'F', '0', '1', 0x00 };
+  const uint8_t *response;
+  uint16_t len;
+  if (!transmit(apdu, sizeof(apdu), EMV_SELECT_DELAY, &response, &len)) {
+    return false;
+  }
+
+  static const uint32_t directoryPath[] = { 0x6F, 0xA5, 0xBF0C };
+  BerTlv directory;
+  if (!BerTlvParser::findPath(response, len, directoryPath, 3, &directory)) {
+    PN5180DEBUG(F("EMV: no directory in PPSE\n"));
+    return false;
+  }
+
+  uint8_t bestPriority = 0xFF;
+  BerTlvParser entries(directory);
+  BerTlv entry;
+  while (entries.next(&entry)) {
+    if (0x61 != entry.tag) {
+      continue;
+    }
+    BerTlv aid, label, priority;
+    if (!BerTlvParser::find(entry.value, entry.length, 0x4F, &aid)) {
+      continue;
+    }
+    uint8_t value = 0x0F;  // no priority given: lowest
+    if (BerTlvParser::find(entry.value, entry.length, 0x87, &priority) && (priority.length > 0)) {
+      value = priority.value[0] & 0x0F;
+    }
+    if (value < bestPriority) {
+      bestPriority = value;
+      card->aid.value = aid.value;
+      card->aid.length = aid.length;
+      if (BerTlvParser::find(entry.value, entry.length, 0x50, &label)) {
+        card->label.value = label.value;
+        card->label.length = label.length;
+      }
+      else {
+        card->label.length = 0;
+      }
+    }
+  }
+  return ((0 != card->aid.length) && (card->aid.length <= 16));
+}
+
+bool PN5180EMV::selectApplication() {
+  uint8_t apdu[5 + 16 + 1];
+  uint8_t apduLen = 0;
+  apdu[apduLen++] = 0x00;
+  apdu[apduLen++] = 0xA4;
+  apdu[apduLen++] = 0x04;
+  apdu[apduLen++] = 0x00;
+  apdu[apduLen++] = card->aid.length;
+  memcpy(&apdu[apduLen], card->aid.value, card->aid.length);
+  apduLen += card->aid.length;
+  apdu[apduLen++] = 0x00;
+
+  const uint8_t *response;
+  uint16_t len;
+  if (!transmit(apdu, apduLen, EMV_SELECT_DELAY, &response, &len)) {
+    return false;
+  }
+  collectTags(response, len, 0);
+  return true;
+}
+
+/*
+ * GET PROCESSING OPTIONS with the PDOL filled from a minimal terminal profile.
+ * Tags not listed below are sent as zeros, which cards accept for a
+ * read-only transaction. The AFL comes back either in format 1 (tag 80:
+ * AIP || AFL) or in format 2 (template 77 with 82 and 94), the latter may
+ * already contain track 2 and PAN.
+ */
+bool PN5180EMV::getProcessingOptions() {
+  uint8_t apdu[5 + 2 + EMV_MAX_PDOL_DATA + 1];
+  uint8_t *pdolData = &apdu[7];
+  uint8_t dataLen = 0;
+
+  for (uint16_t pos=0; pos<pdol.length; ) {
+    uint32_t tag = pdol.value[pos++];
+    if (0x1F == (tag & 0x1F)) {
+      uint8_t b;
+      do {
+        b = (pos < pdol.length) ? pdol.value[pos++] : 0x00;
+        tag = (tag << 8) | b;
+      } while (b & 0x80);
+    }
+    if (pos >= pdol.length) {
+      break;
+    }
+    uint8_t len = pdol.value[pos++];
+    if (dataLen + len > EMV_MAX_PDOL_DATA) {
+      PN5180DEBUG(F("EMV: PDOL too long\n"));
+      return false;
+    }
+
+    uint8_t value[6] = { 0, 0, 0, 0, 0, 0 };
+    switch (tag) {
+      case 0x9F66:  // terminal transaction qualifiers: qVSDC, contact chip, online PIN, signature
+        value[0] = 0x36;
+        break;
+      case 0x9F1A:  // terminal country code
+        value[0] = EMV_TERMINAL_COUNTRY_CODE >> 8; value[1] = EMV_TERMINAL_COUNTRY_CODE & 0xFF;
+        break;
+      case 0x5F2A:  // transaction currency code
+        value[0] = EMV_TRANSACTION_CURRENCY_CODE >> 8; value[1] = EMV_TRANSACTION_CURRENCY_CODE & 0xFF;
+        break;
+      case 0x9F35:  // terminal type: unattended, online with offline capability
+        value[0] = 0x25;
+        break;
+      case 0x9F37:  // unpredictable number
+        if ((NULL == randomSource) || !randomSource(value, 4, randomContext)) {
+          PN5180DEBUG(F("EMV: no random source for the unpredictable number\n"));
+          return false;
+        }
+        break;
+    }
+    memset(&pdolData[dataLen], 0, len);
+    memcpy(&pdolData[dataLen], value, (len < sizeof(value)) ? len : sizeof(value));
+    dataLen += len;
+  }
+
+  apdu[0] = 0x80;
+  apdu[1] = 0xA8;
+  apdu[2] = 0x00;
+  apdu[3] = 0x00;
+  apdu[4] = dataLen + 2;
+  apdu[5] = 0x83;
+  apdu[6] = dataLen;
+  apdu[7 + dataLen] = 0x00;
+
+  const uint8_t *response;
+  uint16_t len;
+  if (!transmit(apdu, 8 + dataLen, EMV_GPO_DELAY, &response, &len)) {
+    return false;
+  }
+
+  BerTlvParser parser(response, len);
+  BerTlv tlv;
+  if (parser.next(&tlv) && (0x80 == tlv.tag)) {
+    if (tlv.length > 2) {
+      afl.value = tlv.value + 2;
+      afl.length = tlv.length - 2;
+    }
+    return true;
+  }
+  collectTags(response, len, 0);
+  return true;
+}
+
+/*
+ * Read the records listed in the AFL in order, 4 bytes per entry:
+ * SFI << 3, first record, last record, records for offline authentication.
+ * Stops as soon as the identification data is complete.
+ */
+bool PN5180EMV::readRecords() {
+  for (uint16_t pos=0; pos+4<=afl.length; pos+=4) {
+    uint8_t sfi = afl.value[pos] >> 3;
+    for (uint16_t record=afl.value[pos+1]; record<=afl.value[pos+2]; record++) {
+      uint8_t apdu[5] = { 0x00, 0xB2, (uint8_t)record, (uint8_t)((sfi << 3) | 0x04), 0x00 };
+      const uint8_t *response;
+      uint16_t len;
+      if (!transmit(apdu, sizeof(apdu), EMV_READ_RECORD_DELAY, &response, &len)) {
+        return false;
+      }
+      collectTags(response, len, 0);
+      if (isComplete()) {
+        return true;
+      }
+    }
+  }
+  return true;
+}
+
+/*
+ * Run PPSE, SELECT AID, GPO and READ RECORD on an EMV card with ISO-DEP
+ * already started. All responses are kept in the arena, the views in data
+ * point into it and stay valid as long as the arena does. 512 bytes are
+ * enough for most cards, a full arena ends the read early.
+ *
+ * return value: true if PAN or track 2 data was found
+ */
+bool PN5180EMV::readCard(EmvCardData *data, uint8_t *arena, uint16_t arenaSize) {
+  memset(data, 0, sizeof(EmvCardData));
+  card = data;
+  this->arena = arena;
+  this->arenaSize = arenaSize;
+  arenaUsed = 0;
+  pdol.value = NULL;
+  pdol.length = 0;
+  afl.value = NULL;
+  afl.length = 0;
+
+  if (!selectPpse() || !selectApplication() || !getProcessingOptions()) {
+    return false;
+  }
+  if (!isComplete()) {
+    readRecords();
+  }
+  return ((0 != card->pan.length) || (0 != card->track2.length));
+}
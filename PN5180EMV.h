@@ -0,0 +1,81 @@
+// NAME: PN5180EMV.h
+//
+// DESC: Read-only EMV contactless data collection (PPSE, SELECT, GPO,
+//       READ RECORD) on top of the ISO-DEP transport of PN5180ISO14443.
+//
+// Copyright (c) 2026 by HOCC2011. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+#ifndef PN5180EMV_H
+#define PN5180EMV_H
+
+#include "PN5180ISO14443.h"
+
+// terminal data sent in the PDOL of GET PROCESSING OPTIONS, ISO 3166 / ISO 4217 numeric codes
+#ifndef EMV_TERMINAL_COUNTRY_CODE
+#define EMV_TERMINAL_COUNTRY_CODE       0x0276
+#endif
+#ifndef EMV_TRANSACTION_CURRENCY_CODE
+#define EMV_TRANSACTION_CURRENCY_CODE   0x0978
+#endif
+
+/*
+ * Value of a tag inside the arena given to readCard(), nothing is copied.
+ * length 0 if the card did not provide the tag.
+ */
+struct EmvTagView {
+  const uint8_t *value;
+  uint16_t length;
+};
+
+struct EmvCardData {
+  EmvTagView aid;             // 4F, AID of the selected application
+  EmvTagView label;           // 50, application label
+  EmvTagView preferredName;   // 9F12, application preferred name
+  EmvTagView pan;             // 5A, application PAN (BCD, padded with F)
+  EmvTagView expiry;          // 5F24, expiration date YYMMDD (BCD)
+  EmvTagView track2;          // 57, track 2 equivalent data, PAN and expiry if 5A/5F24 are missing
+  EmvTagView cardholderName;  // 5F20
+};
+
+class PN5180EMV {
+
+public:
+  PN5180EMV(PN5180ISO14443 &reader);
+
+private:
+  PN5180ISO14443 *reader;
+  uint8_t *arena;
+  uint16_t arenaSize;
+  uint16_t arenaUsed;
+  EmvCardData *card;
+  EmvTagView pdol;
+  EmvTagView afl;
+  PN5180RandomSource randomSource;
+  void *randomContext;
+
+  bool transmit(uint8_t *apdu, uint8_t apduLen, uint8_t readDelay, const uint8_t **response, uint16_t *responseLen);
+  void collectTags(const uint8_t *data, uint16_t len, uint8_t depth);
+  bool isComplete();
+  bool selectPpse();
+  bool selectApplication();
+  bool getProcessingOptions();
+  bool readRecords();
+
+public:
+  bool readCard(EmvCardData *data, uint8_t *arena, uint16_t arenaSize);
+  void setRandomSource(PN5180RandomSource source, void *context = NULL);
+};
+
+#endif /* PN5180EMV_H */
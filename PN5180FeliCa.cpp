@@ -23,16 +23,50 @@
 #include <PN5180.h>
 #include "Debug.h"
 
+#define FELICA_CMD_POLLING          0x00
+#define FELICA_RES_POLLING          0x01
+#define FELICA_CMD_REQUEST_SERVICE  0x02
+#define FELICA_CMD_REQUEST_RESPONSE 0x04
+#define FELICA_CMD_READ             0x06
+#define FELICA_CMD_WRITE            0x08
+#define FELICA_REQUEST_SYSTEM_CODE  0x01
+
+#define FELICA_MAX_FRAME_LEN        255
+#define FELICA_MAX_SERVICES         16   // per Read/Write Without Encryption frame
+#define FELICA_MAX_NODES            32   // per Request Service frame
+#define FELICA_BLOCK_SIZE           16
+
+// IC type in PMm byte 1
+#define FELICA_IC_LITE              0xF0
+#define FELICA_IC_LITE_S            0xF1
+
+// maximum response time parameters in PMm
+#define FELICA_PMM_REQUEST_SERVICE  2
+#define FELICA_PMM_REQUEST_RESPONSE 3
+#define FELICA_PMM_READ             5
+#define FELICA_PMM_WRITE            6
+
+// answer in slot n arrives 2.417ms + n * 1.208ms after the polling request
+#define FELICA_POLL_TIMEOUT(slots)  (3 + ((slots) * 1208 + 999) / 1000)
+
+// chunk per frame received with RX_MULTIPLE_ENABLE, 28 data bytes and 4 status bytes
+#define RX_MULTIPLE_CHUNK_LEN       32
+
+#define POLL_RESULT_NONE            0x00
+#define POLL_RESULT_NEW_CARD        0x01  // a card was added to the list
+#define POLL_RESULT_RETRY           0x02  // garbled or unread slots, poll again
+
 PN5180FeliCa::PN5180FeliCa(uint8_t SSpin, uint8_t BUSYpin, uint8_t RSTpin)
               : PN5180(SSpin, BUSYpin, RSTpin) {
 }
 
 bool PN5180FeliCa::setupRF() {
   PN5180DEBUG(F("Loading RF-Configuration...\n"));
-  if (loadRFConfig(0x09, 0x89)) {  // FeliCa 424 parameters
+  if (loadRFConfig(firstRate, firstRate | 0x80)) {  // FeliCa parameters of the first polling rate
     PN5180DEBUG(F("done.\n"));
   }
   else return false;
+  lastRate = firstRate;
 
   PN5180DEBUG(F("Turning ON RF field...\n"));
   if (setRF_on()) {
@@ -43,6 +77,30 @@ bool PN5180FeliCa::setupRF() {
   return true;
 }
 
+/*
+ * Poll with the given rate first, and with the other one if no card answers
+ * and tryOther is set.
+ */
+void PN5180FeliCa::setPollingOrder(FeliCaBitRate first, bool tryOther) {
+  firstRate = first;
+  lastRate = first;
+  tryOtherRate = tryOther;
+}
+
+/*
+ * Bit rate of the cards found by the last poll, the RF configuration loaded for it.
+ */
+FeliCaBitRate PN5180FeliCa::getBitRate() {
+  return lastRate;
+}
+
+bool PN5180FeliCa::selectBitRate(FeliCaBitRate rate) {
+  if (!selectRFConfig(rate, rate | 0x80)) {  // 08/88 = 212kbit/s, 09/89 = 424kbit/s
+    return false;
+  }
+  return writeRegisterWithAndMask(SYSTEM_CONFIG, 0xFFFFFFBF);  // Switch off Crypto
+}
+
 /*
 * buffer : must be 20 byte array
 * buffer[0-1] is length and 01
@@ -50,49 +108,391 @@ bool PN5180FeliCa::setupRF() {
 * buffer[10..17] is PMm.
 * buffer[18..19] is POL_RES data
 *
+* The answer is detected by RX_IRQ within the single time slot, the RF
+* configuration is only reloaded when the bit rate changes.
+*
 * return value: the uid length in bytes:
 * -	zero if no tag was recognized
 * -	8 if a FeliCa tag was recognized
 */
 uint8_t PN5180FeliCa::pol_req(uint8_t *buffer) {
-	uint8_t cmd[6];
-	uint8_t uidLength = 0;
-	// Load FeliCa 424 protocol
-	if (!loadRFConfig(0x09, 0x89))
-	  return 0;
-	// OFF Crypto
-	if (!writeRegisterWithAndMask(SYSTEM_CONFIG, 0xFFFFFFBF))
-	  return 0;
+  FeliCaCardInfo card;
+  if (0 == pollCards(&card, 1, 0xFFFF, 1)) {  // any target, 1 timeslot only
+    return 0;
+  }
+  buffer[0] = 0x14;
+  buffer[1] = FELICA_RES_POLLING;
+  memcpy(&buffer[2], card.idm, 8);
+  memcpy(&buffer[10], card.pmm, 8);
+  buffer[18] = card.systemCode >> 8;
+  buffer[19] = card.systemCode & 0xFF;
+  return 8;
+}
 
-	//send FeliCa request (every packet starts with length)
-    cmd[0] = 0x06;             //total length
-	cmd[1] = 0x00;             //POL_REQ command
-	cmd[2] = 0xFF;             //
-	cmd[3] = 0xFF;             // any target
-	cmd[4] = 0x01;             // System Code request
-	cmd[5] = 0x00;             // 1 timeslot only
+/*
+ * Send a polling request and collect the answers of all slots. With
+ * RX_MULTIPLE_ENABLE set the PN5180 keeps receiving after a frame and stores
+ * every frame in a chunk of RX_MULTIPLE_CHUNK_LEN bytes: the frame data
+ * followed by a status word laid out like RX_STATUS. Each answer is
+ * length | 01 | IDm (8) | PMm (8) | request data (2)
+ *
+ * Two cards answering in the same slot garble each other, the PN5180 flags
+ * that frame with a CRC or protocol error. Cards not yet in cards[] are
+ * appended.
+ *
+ * return value: POLL_RESULT_* bits
+ */
+uint8_t PN5180FeliCa::receivePollingResponses(uint8_t *cmd, uint16_t timeoutMs, FeliCaCardInfo *cards, uint8_t maxCards, uint8_t *numCards) {
+  uint8_t result = POLL_RESULT_NONE;
+  writeRegisterWithOrMask(TRANSCEIVE_CONTROL, RX_MULTIPLE_ENABLE);
+  clearIRQStatus(RX_IRQ_STAT);
+  if (!sendData(cmd, 6, 0x00)) {
+    writeRegisterWithAndMask(TRANSCEIVE_CONTROL, ~(uint32_t)RX_MULTIPLE_ENABLE);
+    return POLL_RESULT_NONE;
+  }
+  unsigned long start = millis();
+  if (0 != (RX_IRQ_STAT & waitForIRQ(RX_IRQ_STAT, timeoutMs))) {
+    // cards in later slots are still answering, wait for the end of the last slot
+    while ((millis() - start) <= timeoutMs);
 
-	if (!sendData(cmd, 6, 0x00))
-	  return 0;
-    //wait a little to avoid bug with some cards
-    delay(50);
+    uint32_t rxStatus;
+    readRegister(RX_STATUS, &rxStatus);
+    uint8_t numFrames = RX_NUM_FRAMES_RECEIVED(rxStatus);
+    uint8_t *frames = 0;
+    uint16_t chunkLen = RX_MULTIPLE_CHUNK_LEN;
+    if (0 != numFrames) {
+      frames = readData(numFrames * RX_MULTIPLE_CHUNK_LEN);
+    }
+    else {
+      // single frame, no status words: the other slots are unknown
+      numFrames = 1;
+      chunkLen = 0;
+      frames = readData(rxStatus & 0x000001ff);
+      if (0 != cmd[5]) {  // more than one time slot
+        result |= POLL_RESULT_RETRY;
+      }
+    }
+    if (0L == frames) {
+      writeRegisterWithAndMask(TRANSCEIVE_CONTROL, ~(uint32_t)RX_MULTIPLE_ENABLE);
+      return POLL_RESULT_NONE;
+    }
 
-    //response packet should be 0x14 (20 bytes total length), 0x01 Response Code, 8 IDm bytes, 8 PMm bytes, 2 Request Data bytes
-    //READ 20 bytes reply
-  uint8_t *internalBuffer = readData(20);
-	if (!internalBuffer)
-	  return 0;
- for (int i=0; i<20; i++) {
-    buffer[i] = internalBuffer[i];
- }
- 
-    //check Response Code
-    if ( buffer[1] != 0x01 ){
-        uidLength = 0;
-    } else {
-        uidLength = 8;
-    }
-    return uidLength;
+    for (int i=0; i<numFrames; i++) {
+      uint8_t *response = &frames[i * chunkLen];
+      uint32_t frameStatus = rxStatus;
+      if (0 != chunkLen) {
+        uint8_t *status = &response[RX_MULTIPLE_CHUNK_LEN - 4];
+        frameStatus = (uint32_t)status[0] | ((uint32_t)status[1] << 8) | ((uint32_t)status[2] << 16) | ((uint32_t)status[3] << 24);
+      }
+      uint16_t len = (uint16_t)(frameStatus & 0x000001ff);
+      if ((frameStatus & (RX_DATA_INTEGRITY_ERROR | RX_PROTOCOL_ERROR | RX_COLLISION_DETECTED)) ||
+          ((18 != len) && (20 != len)) || (len != response[0]) || (FELICA_RES_POLLING != response[1])) {
+        PN5180DEBUG(F("FeliCa polling collision\n"));
+        result |= POLL_RESULT_RETRY;
+        continue;
+      }
+
+      bool known = false;
+      for (int c=0; c<*numCards; c++) {
+        if (0 == memcmp(cards[c].idm, &response[2], 8)) {
+          known = true;
+          break;
+        }
+      }
+      if (known) {
+        continue;
+      }
+      if (*numCards >= maxCards) {
+        break;
+      }
+      FeliCaCardInfo *card = &cards[(*numCards)++];
+      memcpy(card->idm, &response[2], 8);
+      memcpy(card->pmm, &response[10], 8);
+      card->systemCode = (20 == len) ? (uint16_t)((response[18] << 8) | response[19]) : 0xFFFF;
+      result |= POLL_RESULT_NEW_CARD;
+    }
+  }
+  writeRegisterWithAndMask(TRANSCEIVE_CONTROL, ~(uint32_t)RX_MULTIPLE_ENABLE);
+  return result;
+}
+
+/*
+ * Collect the IDm/PMm of all cards in the field. Each polling request opens
+ * numSlots time slots (1, 2, 4, 8 or 16) and every card answers in a slot
+ * of its own choosing, the answers of all slots are read in one go. The
+ * request is only repeated when cards answered in the same slot and garbled
+ * each other, they pick new slots on the next request. Polling ends when
+ * every answer was read cleanly, the field is empty or no new card showed
+ * up for FELICA_POLL_IDLE_ROUNDS requests.
+ *
+ * systemCode selects the cards to answer, FFFF for any. The bit rates are
+ * tried in the order set with setPollingOrder(), the rate that found cards
+ * stays loaded for the following commands.
+ *
+ * return value: number of cards in cards[]
+ */
+uint8_t PN5180FeliCa::pollCards(FeliCaCardInfo *cards, uint8_t maxCards, uint16_t systemCode, uint8_t numSlots) {
+  uint8_t timeSlots = 0;  // slot count - 1, must be 0, 1, 3, 7 or 15
+  while ((timeSlots < 15) && (timeSlots + 1 < numSlots)) {
+    timeSlots = (timeSlots << 1) | 0x01;
+  }
+  uint16_t timeoutMs = FELICA_POLL_TIMEOUT(timeSlots + 1);
+  uint8_t cmd[6] = { 0x06, FELICA_CMD_POLLING, (uint8_t)(systemCode >> 8), (uint8_t)(systemCode & 0xFF),
+                     FELICA_REQUEST_SYSTEM_CODE, timeSlots };
+
+  uint8_t numCards = 0;
+  FeliCaBitRate rate = lastRate;
+  for (int attempt=0; (0 == numCards) && (attempt < (tryOtherRate ? 2 : 1)); attempt++) {
+    if (0 != attempt) {
+      rate = (FELICA_424 == rate) ? FELICA_212 : FELICA_424;
+    }
+    if (!selectBitRate(rate)) {
+      return 0;
+    }
+
+    uint8_t idleRounds = 0;
+    for (int round=0; (round < FELICA_MAX_POLL_ROUNDS) && (numCards < maxCards) && (idleRounds < FELICA_POLL_IDLE_ROUNDS); round++) {
+      uint8_t rc = receivePollingResponses(cmd, timeoutMs, cards, maxCards, &numCards);
+      if (0 == (rc & POLL_RESULT_RETRY)) {
+        break;  // field empty or all answers read
+      }
+      idleRounds = (rc & POLL_RESULT_NEW_CARD) ? 0 : idleRounds + 1;
+    }
+  }
+  // start with the rate of the cards found on the next call
+  lastRate = (0 != numCards) ? rate : firstRate;
+
+  PN5180DEBUG(F("FeliCa cards found: "));
+  PN5180DEBUG(numCards);
+  PN5180DEBUG(F("\n"));
+  return numCards;
+}
+
+/*
+ * Maximum response time of a command from its PMm byte (E | B | A, 2/3/3 bits):
+ * T * ((B + 1) * n + (A + 1)) * 4^E with T = 0.302ms, n = number of blocks
+ * or nodes. Added is the time on air of command and response at 212kbit/s
+ * (38us per byte plus preamble, sync and CRC).
+ */
+uint16_t PN5180FeliCa::responseTimeout(uint8_t pmmTiming, uint8_t n, uint16_t frameBytes) {
+  uint8_t a = pmmTiming & 0x07;
+  uint8_t b = (pmmTiming >> 3) & 0x07;
+  uint8_t e = pmmTiming >> 6;
+  uint32_t us = (302UL * ((b + 1) * n + (a + 1))) << (2 * e);
+  us += (frameBytes + 20) * 38UL;
+  return (uint16_t)(us / 1000) + 2;
+}
+
+/*
+ * Send a frame (length byte first, IDm in bytes 2..9) and read the card's
+ * answer, which must carry the response code and the same IDm.
+ *
+ * return value: the response in the read buffer of the PN5180 class,
+ * NULL if the card did not answer or the answer was corrupted
+ */
+uint8_t * PN5180FeliCa::exchange(uint8_t *frame, uint16_t timeoutMs, uint16_t *responseLen) {
+  clearIRQStatus(RX_IRQ_STAT);
+  if (!sendData(frame, frame[0], 0x00)) {
+    return NULL;
+  }
+  if (0 == (RX_IRQ_STAT & waitForIRQ(RX_IRQ_STAT, timeoutMs))) {
+    PN5180DEBUG(F("FeliCa: no answer\n"));
+    return NULL;
+  }
+  uint32_t rxStatus;
+  readRegister(RX_STATUS, &rxStatus);
+  uint16_t len = (uint16_t)(rxStatus & 0x000001ff);
+  if ((rxStatus & (RX_DATA_INTEGRITY_ERROR | RX_PROTOCOL_ERROR | RX_COLLISION_DETECTED)) || (len < 10)) {
+    PN5180DEBUG(F("FeliCa: receive error\n"));
+    return NULL;
+  }
+
+  uint8_t *response = readData(len);
+  if ((0L == response) || (len != response[0]) || ((frame[1] + 1) != response[1]) || (0 != memcmp(&response[2], &frame[2], 8))) {
+    return NULL;
+  }
+  *responseLen = len;
+  return response;
+}
+
+/*
+ * Pack as many entries of the block list into one Read/Write Without
+ * Encryption frame as the card takes. The service list of the frame holds
+ * only the services the packed blocks refer to, in order of appearance.
+ * Write data is appended by the caller.
+ *
+ * return value: number of blocks packed
+ */
+uint8_t PN5180FeliCa::buildBlockFrame(uint8_t command, const FeliCaCardInfo *card, const uint16_t *serviceCodes,
+                                      const FeliCaBlock *blocks, uint16_t numBlocks, uint8_t maxBlocks, uint8_t *frame) {
+  uint8_t services[FELICA_MAX_SERVICES];
+  uint8_t numServices = 0;
+  uint8_t blockList[3 * 15];
+  uint8_t blockListLen = 0;
+
+  uint8_t n = 0;
+  for (; (n < numBlocks) && (n < maxBlocks); n++) {
+    uint8_t order = 0;
+    while ((order < numServices) && (services[order] != blocks[n].service)) {
+      order++;
+    }
+    if (order == numServices) {
+      if (FELICA_MAX_SERVICES == numServices) {
+        break;
+      }
+      services[numServices++] = blocks[n].service;
+    }
+    if (blocks[n].number > 0xFF) {
+      blockList[blockListLen++] = order;
+      blockList[blockListLen++] = blocks[n].number & 0xFF;
+      blockList[blockListLen++] = blocks[n].number >> 8;
+    }
+    else {
+      blockList[blockListLen++] = 0x80 | order;  // 2 byte element, access mode 0
+      blockList[blockListLen++] = blocks[n].number;
+    }
+  }
+
+  uint8_t len = 1;
+  frame[len++] = command;
+  memcpy(&frame[len], card->idm, 8);
+  len += 8;
+  frame[len++] = numServices;
+  for (int i=0; i<numServices; i++) {
+    uint16_t code = serviceCodes[services[i]];
+    frame[len++] = code & 0xFF;  // little endian
+    frame[len++] = code >> 8;
+  }
+  frame[len++] = n;
+  memcpy(&frame[len], blockList, blockListLen);
+  frame[0] = len + blockListLen;
+  return n;
+}
+
+/*
+ * Request Service, code=02
+ * Look up the key versions of areas and services, FFFF is returned for
+ * nodes that don't exist. More than 32 nodes are split into several frames.
+ */
+bool PN5180FeliCa::requestService(const FeliCaCardInfo *card, const uint16_t *nodeCodes, uint8_t numNodes, uint16_t *keyVersions) {
+  uint8_t frame[11 + 2 * FELICA_MAX_NODES];
+  while (numNodes > 0) {
+    uint8_t n = (numNodes < FELICA_MAX_NODES) ? numNodes : FELICA_MAX_NODES;
+    frame[0] = 11 + 2 * n;
+    frame[1] = FELICA_CMD_REQUEST_SERVICE;
+    memcpy(&frame[2], card->idm, 8);
+    frame[10] = n;
+    for (int i=0; i<n; i++) {
+      frame[11 + 2*i] = nodeCodes[i] & 0xFF;
+      frame[12 + 2*i] = nodeCodes[i] >> 8;
+    }
+
+    // answer: length | 03 | IDm | n | key versions (2n)
+    uint16_t len;
+    uint8_t *response = exchange(frame, responseTimeout(card->pmm[FELICA_PMM_REQUEST_SERVICE], n, 2 * frame[0]), &len);
+    if ((NULL == response) || (len != 11 + 2 * n) || (n != response[10])) {
+      return false;
+    }
+    for (int i=0; i<n; i++) {
+      keyVersions[i] = response[11 + 2*i] | (response[12 + 2*i] << 8);
+    }
+    nodeCodes += n;
+    keyVersions += n;
+    numNodes -= n;
+  }
+  return true;
+}
+
+/*
+ * Request Response, code=04
+ * Check that the card is still in the field, mode is its current mode (0 after polling).
+ */
+bool PN5180FeliCa::requestResponse(const FeliCaCardInfo *card, uint8_t *mode) {
+  uint8_t frame[10] = { 10, FELICA_CMD_REQUEST_RESPONSE };
+  memcpy(&frame[2], card->idm, 8);
+
+  // answer: length | 05 | IDm | mode
+  uint16_t len;
+  uint8_t *response = exchange(frame, responseTimeout(card->pmm[FELICA_PMM_REQUEST_RESPONSE], 0, 21), &len);
+  if ((NULL == response) || (len != 11)) {
+    return false;
+  }
+  *mode = response[10];
+  return true;
+}
+
+/*
+ * Read Without Encryption, code=06
+ * blocks refer to serviceCodes by index, data receives 16 bytes per block in
+ * list order. The list is sent in as few frames as the card takes: FeliCa
+ * Lite/Lite-S read 4 blocks at once, other cards FELICA_MAX_READ_BLOCKS.
+ */
+bool PN5180FeliCa::readWithoutEncryption(const FeliCaCardInfo *card, const uint16_t *serviceCodes,
+                                         const FeliCaBlock *blocks, uint16_t numBlocks, uint8_t *data) {
+  bool lite = (FELICA_IC_LITE == card->pmm[1]) || (FELICA_IC_LITE_S == card->pmm[1]);
+  uint8_t maxBlocks = lite ? 4 : FELICA_MAX_READ_BLOCKS;
+  uint8_t frame[FELICA_MAX_FRAME_LEN];
+
+  while (numBlocks > 0) {
+    uint8_t n = buildBlockFrame(FELICA_CMD_READ, card, serviceCodes, blocks, numBlocks, maxBlocks, frame);
+
+    // answer: length | 07 | IDm | status flag 1 | status flag 2 | n | block data (16n)
+    uint16_t expectedLen = 13 + FELICA_BLOCK_SIZE * n;
+    uint16_t len;
+    uint8_t *response = exchange(frame, responseTimeout(card->pmm[FELICA_PMM_READ], n, frame[0] + expectedLen), &len);
+    if ((NULL == response) || (len < 12)) {
+      return false;
+    }
+    if ((0x00 != response[10]) || (len != expectedLen) || (n != response[12])) {
+      PN5180DEBUG(F("FeliCa read failed, status flags="));
+      PN5180DEBUG(formatHex(response[10]));
+      PN5180DEBUG(formatHex(response[11]));
+      PN5180DEBUG(F("\n"));
+      return false;
+    }
+    memcpy(data, &response[13], FELICA_BLOCK_SIZE * n);
+    data += FELICA_BLOCK_SIZE * n;
+    blocks += n;
+    numBlocks -= n;
+  }
+  return true;
+}
+
+/*
+ * Write Without Encryption, code=08
+ * Counterpart of readWithoutEncryption(), data holds 16 bytes per block.
+ * FeliCa Lite/Lite-S write a single block per frame, other cards
+ * FELICA_MAX_WRITE_BLOCKS.
+ */
+bool PN5180FeliCa::writeWithoutEncryption(const FeliCaCardInfo *card, const uint16_t *serviceCodes,
+                                          const FeliCaBlock *blocks, uint16_t numBlocks, const uint8_t *data) {
+  bool lite = (FELICA_IC_LITE == card->pmm[1]) || (FELICA_IC_LITE_S == card->pmm[1]);
+  uint8_t maxBlocks = lite ? 1 : FELICA_MAX_WRITE_BLOCKS;
+  uint8_t frame[FELICA_MAX_FRAME_LEN];
+
+  while (numBlocks > 0) {
+    uint8_t n = buildBlockFrame(FELICA_CMD_WRITE, card, serviceCodes, blocks, numBlocks, maxBlocks, frame);
+    memcpy(&frame[frame[0]], data, FELICA_BLOCK_SIZE * n);
+    frame[0] += FELICA_BLOCK_SIZE * n;
+
+    // answer: length | 09 | IDm | status flag 1 | status flag 2
+    uint16_t len;
+    uint8_t *response = exchange(frame, responseTimeout(card->pmm[FELICA_PMM_WRITE], n, frame[0] + 12), &len);
+    if ((NULL == response) || (len != 12)) {
+      return false;
+    }
+    if (0x00 != response[10]) {
+      PN5180DEBUG(F("FeliCa write failed, status flags="));
+      PN5180DEBUG(formatHex(response[10]));
+      PN5180DEBUG(formatHex(response[11]));
+      PN5180DEBUG(F("\n"));
+      return false;
+    }
+    data += FELICA_BLOCK_SIZE * n;
+    blocks += n;
+    numBlocks -= n;
+  }
+  return true;
 }
 
 uint8_t PN5180FeliCa::readCardSerial(uint8_t *buffer) {
@@ -21,18 +21,84 @@
 
 #include "PN5180.h"
 
+// polls sent by pollCards() while answers collide, cards choose a new random slot on every poll
+#ifndef FELICA_MAX_POLL_ROUNDS
+#define FELICA_MAX_POLL_ROUNDS 12
+#endif
+// polls in a row without a new card before pollCards() gives up
+#ifndef FELICA_POLL_IDLE_ROUNDS
+#define FELICA_POLL_IDLE_ROUNDS 3
+#endif
+
+// blocks per Read/Write Without Encryption frame for cards other than
+// FeliCa Lite/Lite-S (4 read, 1 write), must fit into one 255 byte frame
+#ifndef FELICA_MAX_READ_BLOCKS
+#define FELICA_MAX_READ_BLOCKS 12
+#endif
+#ifndef FELICA_MAX_WRITE_BLOCKS
+#define FELICA_MAX_WRITE_BLOCKS 8
+#endif
+#if (FELICA_MAX_READ_BLOCKS > 15) || (FELICA_MAX_WRITE_BLOCKS > 11)
+#error "FeliCa block count exceeds the frame size"
+#endif
+
+// bit rate, same value as the TX RF configuration
+enum FeliCaBitRate {
+  FELICA_212 = 0x08,
+  FELICA_424 = 0x09
+};
+
+/*
+ * Card data from the polling response.
+ */
+struct FeliCaCardInfo {
+  uint8_t idm[8];             // manufacture ID, addresses the card in all further commands
+  uint8_t pmm[8];             // manufacture parameter, IC type and response times
+  uint16_t systemCode;        // system code from the request data
+};
+
+/*
+ * Entry of a block list: the block number within one of the services
+ * passed along with the list.
+ */
+struct FeliCaBlock {
+  uint8_t service;            // index into the service code list
+  uint16_t number;            // block number, > 255 uses the 3 byte block list element
+};
+
 class PN5180FeliCa : public PN5180 {
 
 public:
   PN5180FeliCa(uint8_t SSpin, uint8_t BUSYpin, uint8_t RSTpin);
 
+private:
+  FeliCaBitRate firstRate = FELICA_424;
+  FeliCaBitRate lastRate = FELICA_424;
+  bool tryOtherRate = true;
+
+  bool selectBitRate(FeliCaBitRate rate);
+  uint8_t receivePollingResponses(uint8_t *cmd, uint16_t timeoutMs, FeliCaCardInfo *cards, uint8_t maxCards, uint8_t *numCards);
+  uint16_t responseTimeout(uint8_t pmmTiming, uint8_t n, uint16_t frameBytes);
+  uint8_t * exchange(uint8_t *frame, uint16_t timeoutMs, uint16_t *responseLen);
+  uint8_t buildBlockFrame(uint8_t command, const FeliCaCardInfo *card, const uint16_t *serviceCodes,
+                          const FeliCaBlock *blocks, uint16_t numBlocks, uint8_t maxBlocks, uint8_t *frame);
+
 public:
   uint8_t pol_req(uint8_t *buffer);
+  uint8_t pollCards(FeliCaCardInfo *cards, uint8_t maxCards, uint16_t systemCode = 0xFFFF, uint8_t numSlots = 16);
+  bool requestService(const FeliCaCardInfo *card, const uint16_t *nodeCodes, uint8_t numNodes, uint16_t *keyVersions);
+  bool requestResponse(const FeliCaCardInfo *card, uint8_t *mode);
+  bool readWithoutEncryption(const FeliCaCardInfo *card, const uint16_t *serviceCodes,
+                             const FeliCaBlock *blocks, uint16_t numBlocks, uint8_t *data);
+  bool writeWithoutEncryption(const FeliCaCardInfo *card, const uint16_t *serviceCodes,
+                              const FeliCaBlock *blocks, uint16_t numBlocks, const uint8_t *data);
   /*
    * Helper functions
    */
 public:   
   bool setupRF();
+  void setPollingOrder(FeliCaBitRate first, bool tryOther = true);
+  FeliCaBitRate getBitRate();
   uint8_t readCardSerial(uint8_t *buffer);    
   bool isCardPresent();    
 };
@@ -0,0 +1,101 @@
+// NAME: PN5180Hex.cpp
+//
+// DESC: Allocation-free hex encoding and decoding helpers.
+//
+// Copyright (c) 2026 by HOCC2011. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+#include <Arduino.h>
+#include "PN5180Hex.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static const char hexDigit[] = "0123456789ABCDEF";
+
+// nibble value of each ASCII character, 0xFF for non-hex characters
+static const uint8_t hexValue[256] PROGMEM = {
+  0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+  0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+  0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+     0,   1,   2,   3,   4,   5,   6,   7,   8,   9,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF, // '0'..'9'
+  0xFF,  10,  11,  12,  13,  14,  15,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF, // 'A'..'F'
+  0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+  0xFF,  10,  11,  12,  13,  14,  15,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF, // 'a'..'f'
+  0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+  0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+  0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+  0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+  0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+  0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+  0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+  0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+  0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF
+};
+
+size_t hexEncode(const uint8_t *data, size_t len, char *out, size_t outSize) {
+  if (outSize < 2*len+1) {
+    return 0;
+  }
+
+  size_t i = 0;
+#if defined(__SSE2__)
+  // Host builds: convert 16 bytes per iteration. Each nibble n becomes '0'+n,
+  // plus ('A'-'0'-10) where n > 9, then high and low nibbles are interleaved.
+  const __m128i nibbleMask = _mm_set1_epi8(0x0f);
+  const __m128i nine = _mm_set1_epi8(9);
+  const __m128i zero = _mm_set1_epi8('0');
+  const __m128i alpha = _mm_set1_epi8('A'-'0'-10);
+  for (; i+16 <= len; i += 16) {
+    __m128i in = _mm_loadu_si128((const __m128i *)(data+i));
+    __m128i hi = _mm_and_si128(_mm_srli_epi16(in, 4), nibbleMask);
+    __m128i lo = _mm_and_si128(in, nibbleMask);
+    __m128i first = _mm_unpacklo_epi8(hi, lo);
+    __m128i second = _mm_unpackhi_epi8(hi, lo);
+    first = _mm_add_epi8(_mm_add_epi8(first, zero), _mm_and_si128(_mm_cmpgt_epi8(first, nine), alpha));
+    second = _mm_add_epi8(_mm_add_epi8(second, zero), _mm_and_si128(_mm_cmpgt_epi8(second, nine), alpha));
+    _mm_storeu_si128((__m128i *)(out+2*i), first);
+    _mm_storeu_si128((__m128i *)(out+2*i+16), second);
+  }
+#endif
+  for (; i<len; i++) {
+    out[2*i] = hexDigit[data[i] >> 4];
+    out[2*i+1] = hexDigit[data[i] & 0x0f];
+  }
+  out[2*len] = '\0';
+  return 2*len;
+}
+
+int hexDecode(const char *hex, size_t hexLen, uint8_t *out, size_t outSize) {
+  size_t dataLen = (hexLen+1) / 2;
+  if (outSize < dataLen) {
+    return -2;
+  }
+
+  size_t i = 0;
+  size_t o = 0;
+  if (hexLen & 1) { // odd length, implicit leading '0'
+    uint8_t low = pgm_read_byte(&hexValue[(uint8_t)hex[i++]]);
+    if (low > 0x0f) return -1;
+    out[o++] = low;
+  }
+  for (; i<hexLen; i += 2) {
+    uint8_t high = pgm_read_byte(&hexValue[(uint8_t)hex[i]]);
+    uint8_t low = pgm_read_byte(&hexValue[(uint8_t)hex[i+1]]);
+    if ((high | low) > 0x0f) return -1;
+    out[o++] = (high << 4) | low;
+  }
+  return (int)o;
+}
@@ -0,0 +1,43 @@
+// NAME: PN5180Hex.h
+//
+// DESC: Allocation-free hex encoding and decoding helpers.
+//
+// Copyright (c) 2026 by HOCC2011. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+#ifndef PN5180HEX_H
+#define PN5180HEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Encode len bytes as upper case hex characters into out, followed by a '\0'.
+ * outSize must be at least 2*len+1.
+ *
+ * return value: number of characters written (without '\0'), 0 if out is too small
+ */
+size_t hexEncode(const uint8_t *data, size_t len, char *out, size_t outSize);
+
+/*
+ * Decode hexLen characters from hex into out. Upper and lower case digits are
+ * accepted, an odd number of digits is padded with a leading '0'.
+ *
+ * return value: number of bytes written,
+ *  -1 if hex contains a non-hex character,
+ *  -2 if out is too small
+ */
+int hexDecode(const char *hex, size_t hexLen, uint8_t *out, size_t outSize);
+
+#endif /* PN5180HEX_H */
@@ -4,6 +4,7 @@
 #include "PN5180ISO14443.h"
 #include <PN5180.h>
 #include "Debug.h"
+#include "PN5180Hex.h"
 #include <stdio.h>
 #include <string.h>
 #include <iostream>
@@ -11,6 +12,8 @@
 
 PN5180ISO14443::PN5180ISO14443(uint8_t SSpin, uint8_t BUSYpin, uint8_t RSTpin)
               : PN5180(SSpin, BUSYpin, RSTpin) {
+  memset(mifareKeyTypes, 0, sizeof(mifareKeyTypes));
+  clearCardCache();
 }
 
 bool PN5180ISO14443::setupRF() {
@@ -43,6 +46,21 @@ uint16_t PN5180ISO14443::rxBytesReceived() {
 	return len;
 }
 
+/*
+ * Send a frame and wait for the end of the card's answer (RX_IRQ) instead of a
+ * fixed delay.
+ *
+ * return value: number of bytes received, 0 if the card did not answer within timeoutMs
+ */
+uint16_t PN5180ISO14443::transceive(uint8_t *cmd, uint8_t len, uint8_t validBits, uint16_t timeoutMs) {
+	clearIRQStatus(RX_IRQ_STAT);
+	if (!sendData(cmd, len, validBits))
+	  return 0;
+	if (0 == (RX_IRQ_STAT & waitForIRQ(RX_IRQ_STAT, timeoutMs)))
+	  return 0;
+	return rxBytesReceived();
+}
+
 uint8_t PN5180ISO14443::activateTypeA(uint8_t *buffer, uint8_t kind) {
 
 	/*
@@ -71,6 +89,10 @@ uint8_t PN5180ISO14443::activateTypeA(uint8_t *buffer, uint8_t kind) {
    	// OFF Crypto
     if (!writeRegisterWithAndMask(SYSTEM_CONFIG, 0xFFFFFFBF))
    	  return 0;
+    authenticatedSector = 0xFF;
+    activeUidLength = 0;
+    defaultSession.active = false;
+    activeCard = NULL;
    	// Clear RX CRC
    	if (!writeRegisterWithAndMask(CRC_RX_CONFIG, 0xFFFFFFFE))
    	  return 0;
@@ -159,6 +181,11 @@ uint8_t PN5180ISO14443::activateTypeA(uint8_t *buffer, uint8_t kind) {
        lastSak = buffer[2];
     }
 
+    for (int i = 0; i < uidLength; i++) activeUid[i] = buffer[3+i];
+    activeUidLength = uidLength;
+    activeSak = lastSak;
+    activeCard = cacheCard(buffer, uidLength);
+
     if ((lastSak & 0x20) != 0) {
 		PN5180DEBUG(F("PICC supports IDO-DEP!\n"));
 		cardSupportIsoDep = true;
@@ -171,56 +198,82 @@ uint8_t PN5180ISO14443::activateTypeA(uint8_t *buffer, uint8_t kind) {
 }
 
 bool PN5180ISO14443::startIsoDep() {
-	if (cardSupportIsoDep) {
-		uint8_t atsBuffer[20];
+	return startIsoDep(&defaultSession, 0);
+}
+
+/*
+ * Send RATS to the selected card and set up an ISO-DEP session for it.
+ * cid: card identifier 0..14. A card activated with a CID other than 0 stays
+ * in PROTOCOL state and ignores REQA/WUPA, so further cards can be activated
+ * with activateTypeA() and startIsoDep() with another session and CID.
+ * A cid other than 0 requires a card that supports CID.
+ */
+bool PN5180ISO14443::startIsoDep(IsoDepSession *session, uint8_t cid) {
+	if (cardSupportIsoDep && (cid <= 14)) {
 		PN5180DEBUG(F("--- Starting ISO-DEP (RATS) ---\n"));
+		session->active = false;
 
 		// --- 1. Prepare and Send the RATS Command ---
 		// RATS command: | 0xE0 | FSDI_CID |
-		// FSDI = 0x08 (max FSD = 2048 bytes) and CID = 0x00 -> FSDI_CID = 0x80
-		uint8_t ratsCmd[2] = {0xE0, 0x80};
+		// FSDI = 0x08 (max FSD = 256 bytes) and CID in the low nibble
+		uint8_t ratsCmd[2] = {0xE0, (uint8_t)(0x80 | cid)};
 
 		PN5180DEBUG(F("Sending RATS command...\n"));
-		// Send RATS command (2 bytes, 8 bits in last byte of the first frame, no trailing bits)
-		if (!sendData(ratsCmd, 2, 0x00)) {
-			PN5180DEBUG(F("RATS command failed to send.\n"));
-			return false;
-		}
-
-		uint16_t len;
-		delay(5);
-		len = rxBytesReceived();
-		PN5180DEBUG(F("Finished reading RX bytes received.\n"));
-		String receivedLenString = String(len, DEC);
+		uint16_t len = transceive(ratsCmd, 2, 0x00, 10);
 		PN5180DEBUG(F("Length of RX bytes received: "));
-		PN5180DEBUG(receivedLenString);
+		PN5180DEBUG(len);
 		PN5180DEBUG(F("\n"));
+		if (0 == len) {
+			PN5180DEBUG(F("No ATS received.\n"));
+			return false;
+		}
 
 		// --- 2. Read the ATS Response ---
 		// The max ATS size is 20 bytes (TL=0x14).
+		uint8_t atsBuffer[20];
+		if (len > sizeof(atsBuffer)) len = sizeof(atsBuffer);
 		PN5180DEBUG(F("Reading ATS...\n"));
-		readData(len, atsBuffer);
-		PN5180DEBUG(F("Finished reading ATS...\n"));
+		if (0L == readData(len, atsBuffer)) {
+			return false;
+		}
 		PN5180DEBUG(F("ATS data: "));
 		PN5180DEBUG(bytesToHex(atsBuffer, len));
 		PN5180DEBUG(F("\n"));
 
-
 		// Basic validation of the ATS length and TL byte
 		// TL (atsBuffer[0]) should be between 2 and 20. Actual length should be TL.
 		if (atsBuffer[0] < 2 || atsBuffer[0] > 20) {
 			PN5180DEBUG(F("Invalid ATS TL byte.\n"));
 			return false;
-		} else {
-			PN5180DEBUG(F("ATS TL byte is valid.\n"));
 		}
-
 		if (len < atsBuffer[0]) {
 			PN5180DEBUG(F("Warning: Received ATS length is less than TL byte.\n"));
-			// This might be OK if the PN5180 firmware handles it, but we validate strictly.
-			// For now, let it pass if we got at least TL bytes and readData succeeded for maxAtsLength.
 		}
 
+		ISO14443CardInfo uncached;
+		ISO14443CardInfo *card = (NULL != activeCard) ? activeCard : &uncached;
+		if ((NULL != activeCard) && (activeCard->atsLength == len) && (0 == memcmp(activeCard->ats, atsBuffer, len))) {
+			// --- 3a. Known card with the same ATS, the parameters are taken from the card cache ---
+			PN5180DEBUG(F("Using cached ATS.\n"));
+		}
+		else {
+			// --- 3b. New card or changed ATS ---
+			parseAts(card, atsBuffer, len);
+		}
+
+		if ((0 != cid) && (0 == (card->protocolOptions & 0x02))) {
+			PN5180DEBUG(F("PICC doesn't support CID.\n"));
+			return false;
+		}
+
+		session->cid = cid;
+		session->cidEnabled = (0 != cid);
+		session->nadEnabled = false;
+		session->nad = 0;
+		session->blockNumber = 0;  // first I-block has block number 0
+		session->fsc = card->fsc;
+		session->protocolOptions = card->protocolOptions;
+		session->active = true;
 		PN5180DEBUG(F("ISO-DEP (RATS) Complete\n"));
 		return true;
 	}
@@ -228,53 +281,39 @@ bool PN5180ISO14443::startIsoDep() {
 }
 
 uint16_t PN5180ISO14443::exchangeApdu(uint8_t *apduCommand, uint8_t commandLen, uint8_t *responseBuffer, uint16_t maxResponseLen, uint8_t readDelay) {
+    return exchangeApdu(&defaultSession, apduCommand, commandLen, responseBuffer, maxResponseLen, readDelay);
+}
+
+uint16_t PN5180ISO14443::exchangeApdu(IsoDepSession *session, uint8_t *apduCommand, uint8_t commandLen, uint8_t *responseBuffer, uint16_t maxResponseLen, uint8_t readDelay) {
     PN5180DEBUG(F("Starting to exchange apdu...\n"));
     uint16_t receivedLen;
-    uint8_t PCB[1];
 
     /*
     Coding of I-block PCB:
     Bit 1: Block number -> 0 or 1
     Bit 2: shall be set to 1 -> 1
-    Bit 3: NAD following, if bit is set to 1 -> 0
-    Bit 4: CID following, if bit is set to 1 -> 0
-    Bit 5: Chaining, if bit is set to 1 -> 0
+    Bit 3: NAD following, if bit is set to 1
+    Bit 4: CID following, if bit is set to 1
+    Bit 5: Chaining, if bit is set to 1 -> 1 for all but the last block of a long command
     Bit 6: shall be set to 0, 1 is RFU  -> 0
     Bit 7 & 8: I-Block -> 0, 0
     */
 
-    if (lastPcbIs2 == true) {
-      PCB[0] = {0x03};
-      lastPcbIs2 = false;
-    } else {
-      PCB[0] = {0x02};
-      lastPcbIs2 = true;
-    }
-
-    uint8_t combinedLen = commandLen + 1;
-
-    // Define a new buffer to hold the combined command. Max size is usually small for APDUs.
-    uint8_t combinedCommand[combinedLen]; // Use a sufficiently large array
-
-    // Copy the single PCB byte to the start of the buffer
-    combinedCommand[0] = PCB[0];
-
-    // Copy the APDU command bytes immediately after the PCB byte
-    memcpy(&combinedCommand[1], apduCommand, commandLen);
-
-    String combinedCommandLenString = String(combinedLen, DEC);
-    PN5180DEBUG(F("Length of combined command: "));
-    PN5180DEBUG(combinedCommandLenString);
-    PN5180DEBUG(F("\n"));
+    // The card accepts frames of up to fsc bytes, prologue and CRC included.
+    // Longer commands are chained over several I-blocks.
+    uint16_t maxInf = session->fsc - 2 - 1 - (session->cidEnabled ? 1 : 0) - (session->nadEnabled ? 1 : 0);
+    uint8_t frame[commandLen + 3];
+    uint16_t sentLen = 0;
+    uint16_t frameLen = buildIBlock(session, apduCommand, commandLen, &sentLen, maxInf, frame);
 
     PN5180DEBUG(F("Combined command: "));
-    PN5180DEBUG(bytesToHex(combinedCommand, combinedLen));
+    PN5180DEBUG(bytesToHex(frame, frameLen));
     PN5180DEBUG(F("\n"));
 
     // 1. Send the Command APDU
-    // CRC is handled by the registers set during activation. PCB is assumed to be handled by the driver/firmware.
+    // CRC is handled by the registers set during activation.
     // The last parameter (0x00) indicates no trailing bits.
-    bool tranceive = sendData(combinedCommand, combinedLen, 0x00);
+    bool tranceive = sendData(frame, frameLen, 0x00);
     if (!tranceive) {
       PN5180DEBUG(F("Failed to send data.\n"));
       // Communication failure during transmission
@@ -283,127 +322,634 @@ uint16_t PN5180ISO14443::exchangeApdu(uint8_t *apduCommand, uint8_t commandLen,
        PN5180DEBUG(F("Data successfuly sent.\n"));
     }
 
-    // 2. Wait for the PICC (card) to process and respond
-    // The required time here depends on the card and command complexity.
-    // This is the FWT (Frame Waiting Time) derived from the ATS.
-    // 5ms is often a reasonable starting point for many standard commands.
-    delay(readDelay);
-
-    // 3. Check how many bytes were received from the PICC
-    receivedLen = rxBytesReceived();
-    PN5180DEBUG(F("Finished reading RX bytes received.\n"));
-    String receivedLenString = String(receivedLen, DEC);
-    PN5180DEBUG(F("Length of RX bytes received: "));
-    PN5180DEBUG(receivedLenString);
-    PN5180DEBUG(F("\n"));
-
-    if (receivedLen == 0) {
-      delay(50);
+    // 2. Receive the answer. The card acknowledges chained command blocks
+    // with R(ACK), may ask for more time with S(WTX) and may chain its answer
+    // over several I-blocks, each acknowledged by R(ACK).
+    uint16_t totalLen = 0;
+    uint16_t waitMs = readDelay;
+    uint8_t wtxCount = 0;
+    uint8_t retransmissions = 0;
+    for (bool firstFrame = true; ; firstFrame = false) {
+      // Wait for the PICC (card) to process and respond
+      // The required time here depends on the card and command complexity.
+      // This is the FWT (Frame Waiting Time) derived from the ATS.
+      // 5ms is often a reasonable starting point for many standard commands.
+      if (firstFrame) {
+        delay(readDelay);
+      }
+      else {
+        waitForIRQ(RX_IRQ_STAT, waitMs);
+      }
+
+      // 3. Check how many bytes were received from the PICC
       receivedLen = rxBytesReceived();
-      PN5180DEBUG(F("Finished reading RX bytes received (again).\n"));
-      String receivedLenString = String(receivedLen, DEC);
       PN5180DEBUG(F("Length of RX bytes received: "));
-      PN5180DEBUG(receivedLenString);
+      PN5180DEBUG(receivedLen);
       PN5180DEBUG(F("\n"));
-    }
 
-    // Also ensure the received length does not exceed the provided buffer size
-    if (receivedLen > maxResponseLen) {
-      PN5180DEBUG(F("ReceivedLen (from PICC) > MaxResponseLen (size of buffer).\n"));
-      // If the card sends more data than the buffer can hold, this indicates an issue
-      // (e.g., failed chaining or buffer too small). We should still read 'maxResponseLen'
-      // to clear the FIFO, but report failure.
-      return 0; // Read failed
-    }
+      if (receivedLen == 0) {
+        delay(50);
+        receivedLen = rxBytesReceived();
+        PN5180DEBUG(F("Length of RX bytes received (again): "));
+        PN5180DEBUG(receivedLen);
+        PN5180DEBUG(F("\n"));
+      }
+
+      // Also ensure the received length does not exceed the provided buffer size
+      if ((receivedLen == 0) || (receivedLen > maxResponseLen - totalLen)) {
+        PN5180DEBUG(F("No response or ReceivedLen (from PICC) > MaxResponseLen (size of buffer).\n"));
+        // If the card sends more data than the buffer can hold, this indicates an issue
+        // (e.g., failed chaining or buffer too small).
+        return 0; // Read failed
+      }
+
+      // 4. Read the valid data into the response buffer, behind the blocks received so far
+      uint8_t *block = responseBuffer + totalLen;
+      bool readSuccess = readData(receivedLen, block);
+      if (!readSuccess) {
+        PN5180DEBUG(F("Failed to read data from response buffer.\n"));
+        return 0;
+      } else {
+        PN5180DEBUG(F("Finished reading data from response buffer.\n"));
+      }
+
+      // Prologue: PCB and the CID / NAD bytes announced in it
+      uint8_t pcb = block[0];
+      uint8_t prologueLen = 1 + ((pcb & 0x08) ? 1 : 0) + ((pcb & 0x04) ? 1 : 0);
+      if (receivedLen < prologueLen) {
+        return 0;
+      }
+
+      uint8_t reply[3];
+      uint8_t *out = reply;
+      uint16_t outLen = 0;
+      if ((pcb & 0x08) ? ((block[1] & 0x0F) != session->cid) : session->cidEnabled) {
+        // block of another card: discard it, R(NAK) makes ours repeat its last block
+        if (++retransmissions > ISO_DEP_MAX_RETRANSMISSIONS) {
+          return 0;
+        }
+        PN5180DEBUG(F("Block for another CID discarded.\n"));
+        reply[outLen++] = 0xB2 | session->blockNumber;
+        if (session->cidEnabled) {
+          reply[0] |= 0x08;
+          reply[outLen++] = session->cid;
+        }
+      }
+      else if (0xF2 == (pcb & 0xF7)) {
+        // S(WTX): answer with the same WTXM, the card then has FWT * WTXM
+        if ((receivedLen < prologueLen + 1) || (++wtxCount > ISO_DEP_MAX_WTX)) {
+          PN5180DEBUG(F("Invalid or too many S(WTX).\n"));
+          return 0;
+        }
+        uint8_t wtxm = block[prologueLen] & 0x3F;
+        memcpy(reply, block, prologueLen);
+        outLen = prologueLen;
+        reply[outLen++] = wtxm;
+        waitMs = (uint16_t)readDelay * wtxm + 50;
+        PN5180DEBUG(F("S(WTX) received, WTXM="));
+        PN5180DEBUG(wtxm);
+        PN5180DEBUG(F("\n"));
+      }
+      else if ((0xA2 == (pcb & 0xF6)) && (sentLen < commandLen)) {
+        // R(ACK) for a chained command block: send the next block, or the
+        // last one again if the card acknowledged another block number
+        if ((pcb & 0x01) == session->blockNumber) {
+          session->blockNumber ^= 0x01;
+          frameLen = buildIBlock(session, apduCommand, commandLen, &sentLen, maxInf, frame);
+        }
+        else if (++retransmissions > ISO_DEP_MAX_RETRANSMISSIONS) {
+          return 0;
+        }
+        out = frame;
+        outLen = frameLen;
+        waitMs = (uint16_t)readDelay + 50;
+      }
+      else if ((0x02 == (pcb & 0xE2)) && (sentLen == commandLen)) {
+        // I-block received, toggle the block number
+        session->blockNumber ^= 0x01;
+        memmove(block, block + prologueLen, receivedLen - prologueLen);
+        totalLen += receivedLen - prologueLen;
+        if (0 == (pcb & 0x10)) {
+          break;  // last block of the chain
+        }
+        // chained answer: R(ACK) with the current block number requests the next block
+        reply[outLen++] = 0xA2 | session->blockNumber;
+        if (session->cidEnabled) {
+          reply[0] |= 0x08;
+          reply[outLen++] = session->cid;
+        }
+        waitMs = (uint16_t)readDelay + 50;
+      }
+      else {
+        PN5180DEBUG(F("Unexpected block, PCB="));
+        PN5180DEBUG(formatHex(pcb));
+        PN5180DEBUG(F("\n"));
+        return 0;
+      }
 
-    // 5. Read the valid data into the response buffer
-    bool readSuccess = readData(receivedLen, responseBuffer);
-    if (!readSuccess) {
-      PN5180DEBUG(F("Failed to read data from response buffer.\n"));
-      return 0;
-    } else {
-      PN5180DEBUG(F("Finished reading data from response buffer.\n"));
+      clearIRQStatus(RX_IRQ_STAT);
+      if (!sendData(out, outLen, 0x00)) {
+        PN5180DEBUG(F("Failed to send data.\n"));
+        return 0;
+      }
     }
 
-    remove_first_element(responseBuffer, receivedLen);
     PN5180DEBUG(F("Response data: "));
-    PN5180DEBUG(bytesToHex(responseBuffer, receivedLen - 1));
+    PN5180DEBUG(bytesToHex(responseBuffer, totalLen));
     PN5180DEBUG(F("\n"));
 
     // Success: return the actual length of the received Response APDU.
-    return receivedLen - 1;
+    return totalLen;
+}
+
+/*
+ * Build the next I-block of a command into frame: prologue (PCB, CID, NAD)
+ * and up to maxInf command bytes from *sentLen on, with the chaining bit set
+ * if more bytes follow. The NAD is only sent in the first block of a chain.
+ *
+ * return value: frame length
+ */
+uint16_t PN5180ISO14443::buildIBlock(IsoDepSession *session, const uint8_t *command, uint16_t commandLen,
+                                     uint16_t *sentLen, uint16_t maxInf, uint8_t *frame) {
+    uint16_t frameLen = 0;
+    frame[frameLen++] = 0x02 | session->blockNumber;
+    if (session->cidEnabled) {
+      frame[0] |= 0x08;
+      frame[frameLen++] = session->cid;
+    }
+    if (session->nadEnabled && (0 == *sentLen)) {
+      frame[0] |= 0x04;
+      frame[frameLen++] = session->nad;
+    }
+    uint16_t infLen = commandLen - *sentLen;
+    if (infLen > maxInf) {
+      infLen = maxInf;
+      frame[0] |= 0x10;  // chaining
+    }
+    memcpy(&frame[frameLen], command + *sentLen, infLen);
+    *sentLen += infLen;
+    return frameLen + infLen;
 }
 
 bool PN5180ISO14443::closeIsoDep() {
+	return closeIsoDep(&defaultSession);
+}
+
+bool PN5180ISO14443::closeIsoDep(IsoDepSession *session) {
 
 	/*
 	Coding of S-block PCB:
 	Bit 1: shall be set to 0, 1 is RFU -> 0
 	Bit 2: shall be set to 1, 0 is RFU -> 1
 	Bit 3: shall be set to 0 -> 0
-	Bit 4: CID following, if bit is set to 1 -> 0
+	Bit 4: CID following, if bit is set to 1
 	Bit 5 & 6: (00)b DESELECT or (11)b WTX -> 0, 0
 	Bit 7 & 8: S-Block -> 1, 1
 	*/
 
-	uint8_t cmd[1];
-	cmd[0] = 0xC2;
-	sendData(cmd, 1, 0x00);
+	uint8_t cmd[2];
+	uint8_t len = 0;
+	cmd[len++] = 0xC2;
+	if (session->cidEnabled) {
+		cmd[0] |= 0x08;
+		cmd[len++] = session->cid;
+	}
+	sendData(cmd, len, 0x00);
+	session->active = false;
 	return true;
 }
 
 bool PN5180ISO14443::mifareBlockRead(uint8_t blockno, uint8_t *buffer) {
-	bool success = false;
-	uint16_t len;
 	uint8_t cmd[2];
 	// Send mifare command 30, block no
 	cmd[0] = 0x30;
 	cmd[1] = blockno;
-	if (!sendData(cmd, 2, 0x00))
+	// READ 16 bytes into buffer
+	if (16 != transceive(cmd, 2, 0x00, 5))
 	  return false;
-	//Check if we have received any data from the tag
-	delay(5);
-	len = rxBytesReceived();
-	if (len == 16) {
-		// READ 16 bytes into buffer
-		if (readData(16, buffer))
-		  success = true;
-	}
-	return success;
+	return (0L != readData(16, buffer));
 }
 
 uint8_t PN5180ISO14443::mifareBlockWrite16(uint8_t blockno, uint8_t *buffer) {
-	uint8_t cmd[1];
-	// Clear RX CRC
-	writeRegisterWithAndMask(CRC_RX_CONFIG, 0xFFFFFFFE);
+	uint8_t cmd[2];
 
 	// Mifare write part 1
 	cmd[0] = 0xA0;
 	cmd[1] = blockno;
-	sendData(cmd, 2, 0x00);
-	readData(1, cmd);
-
-	// Mifare write part 2
-	sendData(buffer,16, 0x00);
-	delay(10);
-
-	// Read ACK/NAK
-	readData(1, cmd);
+	uint8_t ack = mifareAckCommand(cmd, 2, 5);
+	if (0x0A != ack)
+	  return ack;
 
-	//Enable RX CRC calculation
-	writeRegisterWithOrMask(CRC_RX_CONFIG, 0x1);
-	return cmd[0];
+	// Mifare write part 2, wait for the ACK/NAK
+	return mifareAckCommand(buffer, 16, 10);
 }
 
 bool PN5180ISO14443::mifareHalt() {
-	uint8_t cmd[1];
+	uint8_t cmd[2];
 	//mifare Halt
 	cmd[0] = 0x50;
 	cmd[1] = 0x00;
 	sendData(cmd, 2, 0x00);
+	// OFF Crypto, the halted card has left the authenticated state
+	writeRegisterWithAndMask(SYSTEM_CONFIG, 0xFFFFFFBF);
+	authenticatedSector = 0xFF;
 	return true;
 }
 
+/*
+ * Send a MIFARE command which is answered with a 4 bit ACK/NAK (WRITE and the
+ * value block operations). RX CRC is disabled while waiting for the answer.
+ *
+ * return value: the ACK (0x0A) or NAK nibble, 0xFF if the card did not answer
+ */
+uint8_t PN5180ISO14443::mifareAckCommand(uint8_t *cmd, uint8_t len, uint16_t timeoutMs) {
+	uint8_t ack = 0xFF;
+	// Clear RX CRC
+	writeRegisterWithAndMask(CRC_RX_CONFIG, 0xFFFFFFFE);
+	if (transceive(cmd, len, 0x00, timeoutMs) > 0) {
+		readData(1, &ack);
+		ack &= 0x0F;
+	}
+	//Enable RX CRC calculation
+	writeRegisterWithOrMask(CRC_RX_CONFIG, 0x01);
+	return ack;
+}
+
+/*
+ * GET_VERSION (60) of NTAG21x / MIFARE Ultralight EV1, version must hold 8 bytes:
+ * header, vendor ID, product type, subtype, major, minor, storage size, protocol type.
+ * Cards without GET_VERSION (Ultralight, Ultralight C) answer with a NAK and
+ * must be activated again.
+ */
+bool PN5180ISO14443::ntagGetVersion(uint8_t *version) {
+	uint8_t cmd[1] = { 0x60 };
+	if (8 != transceive(cmd, 1, 0x00, 5))
+	  return false;
+	return (0L != readData(8, version));
+}
+
+/*
+ * Number of pages (4 bytes each) from the storage size of GET_VERSION,
+ * at most the 256 pages a page address can reach. 0 if the card did not
+ * answer GET_VERSION or reports an invalid size.
+ */
+uint16_t PN5180ISO14443::ntagGetNumPages() {
+	uint8_t version[8];
+	if (!ntagGetVersion(version))
+	  return 0;
+	switch (version[6]) {
+	  case 0x0B: return 20;   // Ultralight EV1 MF0UL11
+	  case 0x0E: return 41;   // Ultralight EV1 MF0UL21
+	  case 0x0F: return 45;   // NTAG213
+	  case 0x11: return 135;  // NTAG215
+	  case 0x13: return 231;  // NTAG216
+	  default: {
+	    if (version[6] > 0x20)
+	      return 0;
+	    // storage size: 2^(n/2) user bytes, rounded down for odd n, plus 4 config pages
+	    uint32_t numPages = ((1UL << (version[6] >> 1)) / 4) + 4;
+	    return (numPages > 256) ? 256 : (uint16_t)numPages;
+	  }
+	}
+}
+
+/*
+ * FAST_READ (3A) of pages startPage..endPage (inclusive). Large ranges are split
+ * into exchanges of NTAG_FAST_READ_MAX_PAGES pages, buffer must hold 4 bytes per page.
+ *
+ * return value: number of bytes read, less than requested if the card stopped answering
+ */
+uint16_t PN5180ISO14443::ntagFastRead(uint8_t startPage, uint8_t endPage, uint8_t *buffer) {
+	uint16_t total = 0;
+	uint16_t page = startPage;
+	while (page <= endPage) {
+		uint16_t last = page + NTAG_FAST_READ_MAX_PAGES - 1;
+		if (last > endPage) last = endPage;
+		uint16_t expected = (last - page + 1) * 4;
+
+		uint8_t cmd[3] = { 0x3A, (uint8_t)page, (uint8_t)last };
+		// ~0.1ms air time per byte at 106 kbit/s
+		uint16_t len = transceive(cmd, 3, 0x00, 5 + expected / 10);
+		if (len != expected) {
+			PN5180DEBUG(F("FAST_READ failed.\n"));
+			return total;
+		}
+		if (0L == readData(len, buffer + total))
+		  return total;
+		total += len;
+		page = last + 1;
+	}
+	return total;
+}
+
+/*
+ * Dump the whole card memory, the size is detected with GET_VERSION.
+ *
+ * return value: number of bytes read, 0 if the size is unknown
+ */
+uint16_t PN5180ISO14443::ntagReadMemory(uint8_t *buffer, uint16_t maxLen) {
+	uint16_t numPages = ntagGetNumPages();
+	if (numPages > maxLen / 4) numPages = maxLen / 4;
+	if (0 == numPages)
+	  return 0;
+	return ntagFastRead(0, numPages - 1, buffer);
+}
+
+/*
+ * WRITE (A2) of one 4 byte page, returns as soon as the card has sent its ACK.
+ */
+bool PN5180ISO14443::ntagWritePage(uint8_t page, uint8_t *data) {
+	uint8_t cmd[6] = { 0xA2, page, data[0], data[1], data[2], data[3] };
+	// NTAG21x write time is 4.1ms
+	return (0x0A == mifareAckCommand(cmd, 6, 10));
+}
+
+/*
+ * Write numPages consecutive pages, each WRITE follows directly on the ACK of the
+ * previous one.
+ *
+ * return value: number of pages written
+ */
+uint8_t PN5180ISO14443::ntagWritePages(uint8_t startPage, uint8_t *data, uint8_t numPages) {
+	uint8_t cmd[6];
+	uint8_t written = 0;
+	cmd[0] = 0xA2;
+	// Clear RX CRC once for the whole sequence, ACKs have no CRC
+	writeRegisterWithAndMask(CRC_RX_CONFIG, 0xFFFFFFFE);
+	while (written < numPages) {
+		cmd[1] = startPage + written;
+		for (int i = 0; i < 4; i++) cmd[2+i] = data[4*written + i];
+		uint8_t ack = 0xFF;
+		if (0 == transceive(cmd, 6, 0x00, 10))
+		  break;
+		readData(1, &ack);
+		if (0x0A != (ack & 0x0F))
+		  break;
+		written++;
+	}
+	//Enable RX CRC calculation
+	writeRegisterWithOrMask(CRC_RX_CONFIG, 0x01);
+	return written;
+}
+
+/*
+ * Bring pages startPage..startPage+numPages-1 to the content of image,
+ * writing only the pages that differ. The current content is read with
+ * FAST_READ (NTAG21x) of up to NTAG_FAST_READ_MAX_PAGES pages and compared
+ * in the read buffer of the PN5180 class, which the writes don't touch.
+ * Tags without FAST_READ (Ultralight and other Type 2 tags) NAK it and are
+ * reactivated and read with READ, 4 pages at a time. Runs of changed pages
+ * are written back to back with ntagWritePages().
+ *
+ * return value: true if the card holds the image now
+ */
+bool PN5180ISO14443::ntagSyncPages(uint8_t startPage, uint8_t *image, uint8_t numPages, uint8_t *pagesWritten) {
+	uint8_t block[16];
+	bool fastRead = true;
+	*pagesWritten = 0;
+	uint16_t window = 0;
+	while (window < numPages) {
+		uint8_t n;
+		const uint8_t *current;
+		if (fastRead) {
+			n = ((numPages - window) < NTAG_FAST_READ_MAX_PAGES) ? (numPages - window) : NTAG_FAST_READ_MAX_PAGES;
+			uint8_t cmd[3] = { 0x3A, (uint8_t)(startPage + window), (uint8_t)(startPage + window + n - 1) };
+			if ((4 * n != transceive(cmd, 3, 0x00, 5 + 4 * n / 10)) || (0L == (current = readData(4 * n)))) {
+				// the NAK sends the tag back to IDLE
+				PN5180DEBUG(F("No FAST_READ, falling back to READ.\n"));
+				fastRead = false;
+				const ISO14443CardInfo *card = getCardInfo();
+				uint8_t atqaSakUid[10];
+				if ((NULL == card) || (0 == reactivateTypeA(card->uid, card->uidLength, atqaSakUid)))
+				  return false;
+				continue;
+			}
+		}
+		else {
+			n = ((numPages - window) < 4) ? (numPages - window) : 4;
+			if (!mifareBlockRead(startPage + window, block))
+			  return false;
+			current = block;
+		}
+
+		uint8_t page = 0;
+		while (page < n) {
+			if (0 == memcmp(&current[4*page], &image[4*(window + page)], 4)) {
+				page++;
+				continue;
+			}
+			uint8_t runLength = 1;
+			while ((page + runLength < n) && (0 != memcmp(&current[4*(page + runLength)], &image[4*(window + page + runLength)], 4)))
+			  runLength++;
+			uint8_t written = ntagWritePages(startPage + window + page, &image[4*(window + page)], runLength);
+			*pagesWritten += written;
+			if (written != runLength)
+			  return false;
+			page += runLength;
+		}
+		window += n;
+	}
+	return true;
+}
+
+/*
+ * MIFARE Classic memory layout:
+ * sector 0..31 have 4 blocks, sector 32..39 (4K only) have 16 blocks.
+ * The last block of each sector is the sector trailer with keys and access bits.
+ */
+uint8_t PN5180ISO14443::mifareSectorOfBlock(uint8_t blockNo) {
+	if (blockNo < 128) return blockNo / 4;
+	return 32 + (blockNo - 128) / 16;
+}
+
+uint8_t PN5180ISO14443::mifareFirstBlockOfSector(uint8_t sector) {
+	if (sector < 32) return sector * 4;
+	return 128 + (sector - 32) * 16;
+}
+
+uint8_t PN5180ISO14443::mifareBlocksInSector(uint8_t sector) {
+	return (sector < 32) ? 4 : 16;
+}
+
+/*
+ * Store the key used to authenticate a sector, sector 0xFF sets the key for all sectors.
+ * keyType: MIFARE_KEY_A or MIFARE_KEY_B
+ */
+void PN5180ISO14443::mifareSetKey(uint8_t sector, uint8_t keyType, const uint8_t *key) {
+	uint8_t first = sector;
+	uint8_t last = sector;
+	if (0xFF == sector) {
+		first = 0;
+		last = MIFARE_CLASSIC_MAX_SECTORS - 1;
+	}
+	else if (sector >= MIFARE_CLASSIC_MAX_SECTORS) {
+		return;
+	}
+	for (int s = first; s <= last; s++) {
+		memcpy(mifareKeys[s], key, 6);
+		mifareKeyTypes[s] = keyType;
+		if (s == authenticatedSector) authenticatedSector = 0xFF;
+	}
+}
+
+/*
+ * Authenticate the sector of blockNo with the cached key. Nothing is sent if this
+ * sector is already authenticated, so consecutive accesses to one sector cost a
+ * single authentication.
+ * A failed authentication halts the card, it must be activated again.
+ */
+bool PN5180ISO14443::mifareClassicAuthenticate(uint8_t blockNo) {
+	uint8_t sector = mifareSectorOfBlock(blockNo);
+	if (sector == authenticatedSector)
+	  return true;
+	if ((sector >= MIFARE_CLASSIC_MAX_SECTORS) || (0 == mifareKeyTypes[sector])) {
+		PN5180DEBUG(F("No key for sector.\n"));
+		return false;
+	}
+	if (activeUidLength < 4)
+	  return false;
+
+	// 7 byte UIDs authenticate with the last 4 UID bytes
+	uint8_t status = mifareAuthenticate(blockNo, mifareKeys[sector], mifareKeyTypes[sector],
+	                                    activeUid + activeUidLength - 4);
+	if (0 != status) {
+		PN5180DEBUG(F("Authentication failed.\n"));
+		// OFF Crypto
+		writeRegisterWithAndMask(SYSTEM_CONFIG, 0xFFFFFFBF);
+		authenticatedSector = 0xFF;
+		return false;
+	}
+	authenticatedSector = sector;
+	return true;
+}
+
+/*
+ * Read all blocks of a sector including the trailer,
+ * buffer must hold mifareBlocksInSector(sector)*16 bytes.
+ */
+bool PN5180ISO14443::mifareClassicReadSector(uint8_t sector, uint8_t *buffer) {
+	uint8_t first = mifareFirstBlockOfSector(sector);
+	if (!mifareClassicAuthenticate(first))
+	  return false;
+	for (int i = 0; i < mifareBlocksInSector(sector); i++) {
+		if (!mifareBlockRead(first + i, buffer + 16*i))
+		  return false;
+	}
+	return true;
+}
+
+/*
+ * Read sectors 0..numSectors-1 into buffer, which is laid out like the card memory
+ * (1024 bytes for 16 sectors, 4096 bytes for 40 sectors).
+ *
+ * return value: number of sectors read, reading stops at the first sector which
+ * cannot be authenticated or read.
+ */
+uint8_t PN5180ISO14443::mifareClassicReadCard(uint8_t *buffer, uint8_t numSectors) {
+	for (uint8_t s = 0; s < numSectors; s++) {
+		if (!mifareClassicReadSector(s, buffer + 16 * mifareFirstBlockOfSector(s)))
+		  return s;
+	}
+	return numSectors;
+}
+
+bool PN5180ISO14443::mifareClassicWriteBlock(uint8_t blockNo, uint8_t *buffer) {
+	if (!mifareClassicAuthenticate(blockNo))
+	  return false;
+	uint8_t cmd[2] = { 0xA0, blockNo };
+	if (0x0A != mifareAckCommand(cmd, 2, 5))
+	  return false;
+	return (0x0A == mifareAckCommand(buffer, 16, 10));
+}
+
+/*
+ * Write the data blocks of a sector, the sector trailer is never written.
+ * In sector 0 the read-only manufacturer block is skipped, too.
+ * buffer holds 16 bytes for each written block.
+ */
+bool PN5180ISO14443::mifareClassicWriteSector(uint8_t sector, uint8_t *buffer) {
+	uint8_t first = mifareFirstBlockOfSector(sector);
+	uint8_t trailer = first + mifareBlocksInSector(sector) - 1;
+	if (0 == sector) first = 1;
+	for (uint8_t block = first; block < trailer; block++) {
+		if (!mifareClassicWriteBlock(block, buffer))
+		  return false;
+		buffer += 16;
+	}
+	return true;
+}
+
+/*
+ * Value block format: value, ~value, value (4 bytes LSB first each), addr, ~addr, addr, ~addr
+ */
+bool PN5180ISO14443::mifareValueRead(uint8_t blockNo, int32_t *value) {
+	uint8_t block[16];
+	if (!mifareClassicAuthenticate(blockNo))
+	  return false;
+	if (!mifareBlockRead(blockNo, block))
+	  return false;
+	for (int i = 0; i < 4; i++) {
+		if ((block[i] != block[8+i]) || (block[i] != (uint8_t)~block[4+i])) {
+			PN5180DEBUG(F("Not a value block.\n"));
+			return false;
+		}
+	}
+	*value = (int32_t)((uint32_t)block[0] | ((uint32_t)block[1] << 8) | ((uint32_t)block[2] << 16) | ((uint32_t)block[3] << 24));
+	return true;
+}
+
+bool PN5180ISO14443::mifareValueWrite(uint8_t blockNo, int32_t value) {
+	uint8_t block[16];
+	for (int i = 0; i < 4; i++) {
+		uint8_t b = (uint8_t)((uint32_t)value >> (8*i));
+		block[i] = b;
+		block[4+i] = ~b;
+		block[8+i] = b;
+	}
+	block[12] = blockNo;
+	block[13] = ~blockNo;
+	block[14] = blockNo;
+	block[15] = ~blockNo;
+	return mifareClassicWriteBlock(blockNo, block);
+}
+
+/*
+ * INCREMENT (C1), DECREMENT (C0) and RESTORE (C2) load the result into the card's
+ * transfer buffer, mifareValueTransfer() writes it to a block of the same sector.
+ * The operand is not acknowledged, only a NAK is sent back on failure.
+ */
+bool PN5180ISO14443::mifareValueOperation(uint8_t opcode, uint8_t blockNo, int32_t operand) {
+	if (!mifareClassicAuthenticate(blockNo))
+	  return false;
+	uint8_t cmd[4] = { opcode, blockNo };
+	if (0x0A != mifareAckCommand(cmd, 2, 5))
+	  return false;
+	for (int i = 0; i < 4; i++) {
+		cmd[i] = (uint8_t)((uint32_t)operand >> (8*i));
+	}
+	uint8_t ack = mifareAckCommand(cmd, 4, 5);
+	return ((0xFF == ack) || (0x0A == ack));
+}
+
+bool PN5180ISO14443::mifareValueIncrement(uint8_t blockNo, int32_t delta) {
+	return mifareValueOperation(0xC1, blockNo, delta);
+}
+
+bool PN5180ISO14443::mifareValueDecrement(uint8_t blockNo, int32_t delta) {
+	return mifareValueOperation(0xC0, blockNo, delta);
+}
+
+bool PN5180ISO14443::mifareValueRestore(uint8_t blockNo) {
+	return mifareValueOperation(0xC2, blockNo, 0);
+}
+
+bool PN5180ISO14443::mifareValueTransfer(uint8_t blockNo) {
+	if (!mifareClassicAuthenticate(blockNo))
+	  return false;
+	uint8_t cmd[2] = { 0xB0, blockNo };
+	return (0x0A == mifareAckCommand(cmd, 2, 10));
+}
+
 bool PN5180ISO14443::typeAHalt() {
 	uint8_t cmd[2];
 	cmd[0] = 0x50;
@@ -421,7 +967,7 @@ uint8_t PN5180ISO14443::readCardSerial(uint8_t *buffer) {
     // UID 4 bytes : offset 3 to 6 is UID, offset 7 to 9 to Zero
     // UID 7 bytes : offset 3 to 9 is UID
     for (int i = 0; i < 10; i++) response[i] = 0;
-    uidLength = activateTypeA(response, 1);
+    uidLength = activateRecentOrNewCard(response);
 	if ((response[0] == 0xFF) && (response[1] == 0xFF))
 	  return 0;
 	// check for valid uid
@@ -435,6 +981,8 @@ uint8_t PN5180ISO14443::readCardSerial(uint8_t *buffer) {
 
 bool PN5180ISO14443::isCardPresent() {
     uint8_t buffer[10];
+	if (presenceCheckMode && (activeUidLength > 0) && presenceCheck())
+	  return true;
 	return (readCardSerial(buffer) >=4);
 }
 
@@ -442,13 +990,15 @@ bool PN5180ISO14443::isIsoDepCardPresent() {
     uint8_t buffer[10];
     uint8_t response[32];
 	uint8_t uidLength;
+	if (presenceCheckMode && defaultSession.active && presenceCheck())
+	  return true;
 	// Always return 10 bytes
     // Offset 0..1 is ATQA
     // Offset 2 is SAK.
     // UID 4 bytes : offset 3 to 6 is UID, offset 7 to 9 to Zero
     // UID 7 bytes : offset 3 to 9 is UID
     for (int i = 0; i < 10; i++) response[i] = 0;
-    uidLength = activateTypeA(response, 1);
+    uidLength = activateRecentOrNewCard(response);
 	if (cardSupportIsoDep) {
 		startIsoDep();
 	}
@@ -466,68 +1016,288 @@ bool PN5180ISO14443::isIsoDepCardPresent() {
 	return (uidLength >= 4);
 }
 
-bool PN5180ISO14443::piccSupportIsoDep() {
-	return cardSupportIsoDep;
+/*
+ * Select a card in READY state by its known UID (cascade level 1 and, for
+ * 7 byte UIDs, cascade level 2), without anticollision. CRC is enabled afterwards.
+ */
+bool PN5180ISO14443::selectTypeA(const uint8_t *uid, uint8_t uidLength, uint8_t *sak) {
+	uint8_t cmd[7];
+	//Enable RX CRC calculation
+	if (!writeRegisterWithOrMask(CRC_RX_CONFIG, 0x01))
+	  return false;
+	//Enable TX CRC calculation
+	if (!writeRegisterWithOrMask(CRC_TX_CONFIG, 0x01))
+	  return false;
+
+	uint8_t levels = (uidLength == 7) ? 2 : 1;
+	for (uint8_t level = 0; level < levels; level++) {
+		cmd[0] = (level == 0) ? 0x93 : 0x95;
+		cmd[1] = 0x70;
+		if (levels == 2 && level == 0) {
+			// cascade tag 88 followed by the first 3 UID bytes
+			cmd[2] = 0x88;
+			for (int i = 0; i < 3; i++) cmd[3+i] = uid[i];
+		}
+		else {
+			const uint8_t *part = (level == 0) ? uid : uid + 3;
+			for (int i = 0; i < 4; i++) cmd[2+i] = part[i];
+		}
+		cmd[6] = cmd[2] ^ cmd[3] ^ cmd[4] ^ cmd[5];  // BCC
+		if (1 != transceive(cmd, 7, 0x00, 5))
+		  return false;
+		if (!readData(1, sak))
+		  return false;
+	}
+	return true;
 }
 
-/*--------------------Byte conversion voids--------------------*/
+/*
+ * Bring a known card from IDLE or HALT state back to ACTIVE: WUPA followed
+ * directly by SELECT with the known UID.
+ */
+bool PN5180ISO14443::wakeupTypeA(const uint8_t *uid, uint8_t uidLength, uint8_t *sak) {
+	uint8_t cmd[1];
+	uint8_t atqa[2];
+	// Clear RX CRC
+	if (!writeRegisterWithAndMask(CRC_RX_CONFIG, 0xFFFFFFFE))
+	  return false;
+	// Clear TX CRC
+	if (!writeRegisterWithAndMask(CRC_TX_CONFIG, 0xFFFFFFFE))
+	  return false;
+	//Send WUPA (0x52), 7 bits in last byte
+	cmd[0] = 0x52;
+	if (2 != transceive(cmd, 1, 0x07, 5))
+	  return false;
+	if (!readData(2, atqa))
+	  return false;
+	return selectTypeA(uid, uidLength, sak);
+}
 
-size_t PN5180ISO14443::hexStringToByteArray(const String& s, uint8_t* data_out) {
-    String hex_string = s;
-    int len = hex_string.length();
+/*
+ * Check if the activated card is still in the field, without leaving the
+ * current card state:
+ * - ISO-DEP session: R(NAK) with the current block number, answered by R(ACK).
+ *   The block numbers stay unchanged, the session continues.
+ * - MIFARE Classic with an authenticated sector: encrypted READ of that sector.
+ * - Type 2 (SAK 00): READ of page 0.
+ * - other cards: HLTA followed by WUPA and SELECT with the known UID.
+ * A card that fails the check is considered gone, activateTypeA() is required.
+ */
+bool PN5180ISO14443::presenceCheck() {
+	if (0 == activeUidLength)
+	  return false;
 
-    // 1. Pad with leading '0' if length is odd
-    if (len % 2 != 0) {
-        hex_string = "0" + hex_string;
-        len = hex_string.length();
-    }
+	bool present = false;
+	if (defaultSession.active) {
+		uint8_t rNak[1] = { (uint8_t)(0xB2 | defaultSession.blockNumber) };
+		uint8_t rAck;
+		if ((1 == transceive(rNak, 1, 0x00, 10)) && readData(1, &rAck))
+		  present = (0xA2 == (rAck & 0xF6));
+	}
+	else if (0xFF != authenticatedSector) {
+		uint8_t block[16];
+		present = mifareBlockRead(mifareFirstBlockOfSector(authenticatedSector), block);
+	}
+	else if (0x00 == activeSak) {
+		uint8_t cmd[2] = { 0x30, 0x00 };
+		present = (16 == transceive(cmd, 2, 0x00, 5));
+	}
+	else {
+		uint8_t sak;
+		typeAHalt();
+		present = wakeupTypeA(activeUid, activeUidLength, &sak);
+	}
 
-    size_t data_len = len / 2;
-
-    for (int i = 0; i < len; i += 2) {
-        // Read the first character (high nibble)
-        char high_char = hex_string.charAt(i);
-        // Read the second character (low nibble)
-        char low_char = hex_string.charAt(i + 1);
-
-        // Custom logic to convert hex char to value (0-15)
-        uint8_t high_nibble;
-        if (high_char >= '0' && high_char <= '9') {
-            high_nibble = high_char - '0';
-        } else if (high_char >= 'A' && high_char <= 'F') {
-            high_nibble = high_char - 'A' + 10;
-        } else if (high_char >= 'a' && high_char <= 'f') {
-            high_nibble = high_char - 'a' + 10;
-        } else {
-            // Non-hex character, treat as 0 or handle error
-            high_nibble = 0;
-        }
+	if (!present) {
+		PN5180DEBUG(F("Card is gone.\n"));
+		// OFF Crypto
+		writeRegisterWithAndMask(SYSTEM_CONFIG, 0xFFFFFFBF);
+		authenticatedSector = 0xFF;
+		activeUidLength = 0;
+		defaultSession.active = false;
+		activeCard = NULL;
+	}
+	return present;
+}
 
-        uint8_t low_nibble;
-        if (low_char >= '0' && low_char <= '9') {
-            low_nibble = low_char - '0';
-        } else if (low_char >= 'A' && low_char <= 'F') {
-            low_nibble = low_char - 'A' + 10;
-        } else if (low_char >= 'a' && low_char <= 'f') {
-            low_nibble = low_char - 'a' + 10;
-        } else {
-            // Non-hex character, treat as 0 or handle error
-            low_nibble = 0;
-        }
+/*
+ * In presence check mode isCardPresent() and isIsoDepCardPresent() first check
+ * the already activated card with presenceCheck() and only run the full
+ * activation if there is none, so an open ISO-DEP session survives the polling.
+ */
+void PN5180ISO14443::setPresenceCheckMode(bool enabled) {
+	presenceCheckMode = enabled;
+}
 
-        // Combine nibbles: (high << 4) + low
-        data_out[i / 2] = (high_nibble << 4) | low_nibble;
-    }
+/*
+ * ATS: TL, T0, TA(1), TB(1), TC(1), historical bytes
+ * T0 bits 7..5 announce TC, TB, TA; bits 3..0 are FSCI.
+ */
+void PN5180ISO14443::parseAts(ISO14443CardInfo *card, const uint8_t *ats, uint8_t len) {
+	static const uint16_t fscTable[] = { 16, 24, 32, 40, 48, 64, 96, 128, 256, 512, 1024, 2048, 4096 };
+	memcpy(card->ats, ats, len);
+	card->atsLength = len;
+	card->fsc = 32;  // default if T0 is absent
+	card->protocolOptions = 0x02;
+	if (len < 2)
+	  return;
+	uint8_t fsci = ats[1] & 0x0F;
+	card->fsc = (fsci < 13) ? fscTable[fsci] : 256;
+	card->protocolOptions = 0x02;  // default: CID supported, NAD not supported
+	uint8_t pos = 2;
+	if (ats[1] & 0x10) { // TA(1): bit rates, only 106 kbit/s is used
+		pos++;
+	}
+	if (ats[1] & 0x20) { // TB(1)
+		pos++;
+	}
+	if ((ats[1] & 0x40) && (len > pos)) { // TC(1)
+		card->protocolOptions = ats[pos] & 0x03;
+	}
+}
+
+ISO14443CardInfo *PN5180ISO14443::findCachedCard(const uint8_t *uid, uint8_t uidLength) {
+	for (int i = 0; i < ISO14443_CARD_CACHE_SIZE; i++) {
+		if ((cardCache[i].uidLength == uidLength) && (0 == memcmp(cardCache[i].uid, uid, uidLength)))
+		  return &cardCache[i];
+	}
+	return NULL;
+}
+
+/*
+ * Add the card just activated (buffer as filled by activateTypeA) to the cache,
+ * replacing the least recently seen entry. The ATS of a known card is kept.
+ */
+ISO14443CardInfo *PN5180ISO14443::cacheCard(const uint8_t *buffer, uint8_t uidLength) {
+	ISO14443CardInfo *card = findCachedCard(buffer+3, uidLength);
+	if ((NULL != card) && (card->sak != buffer[2])) {
+		card->atsLength = 0;
+	}
+	if (NULL == card) {
+		card = &cardCache[0];
+		for (int i = 1; i < ISO14443_CARD_CACHE_SIZE; i++) {
+			if (0 == card->uidLength)
+			  break;
+			if ((0 == cardCache[i].uidLength) || (cardCache[i].lastSeen < card->lastSeen))
+			  card = &cardCache[i];
+		}
+		memcpy(card->uid, buffer+3, uidLength);
+		card->uidLength = uidLength;
+		card->atsLength = 0;
+		card->fsc = 32;
+		card->protocolOptions = 0x02;
+	}
+	card->atqa[0] = buffer[0];
+	card->atqa[1] = buffer[1];
+	card->sak = buffer[2];
+	card->lastSeen = millis();
+	return card;
+}
+
+/*
+ * Reactivate a card from the cache: WUPA followed directly by SELECT with the
+ * cached UID, no anticollision. A following startIsoDep() takes the ATS
+ * parameters from the cache if the card sends the same ATS again.
+ *
+ * buffer: as for activateTypeA, must be 10 byte array
+ * return value: uid length, zero if the card is not cached or did not answer
+ */
+uint8_t PN5180ISO14443::reactivateTypeA(const uint8_t *uid, uint8_t uidLength, uint8_t *buffer) {
+	ISO14443CardInfo *card = findCachedCard(uid, uidLength);
+	if (NULL == card)
+	  return 0;
+
+	// Load standard TypeA protocol
+	if (!loadRFConfig(0x0, 0x80))
+	  return 0;
+	// OFF Crypto
+	if (!writeRegisterWithAndMask(SYSTEM_CONFIG, 0xFFFFFFBF))
+	  return 0;
+	authenticatedSector = 0xFF;
+	activeUidLength = 0;
+	defaultSession.active = false;
+	activeCard = NULL;
+
+	uint8_t sak;
+	if (!wakeupTypeA(card->uid, card->uidLength, &sak))
+	  return 0;
+	if (sak != card->sak) {
+		card->sak = sak;
+		card->atsLength = 0;
+	}
+
+	buffer[0] = card->atqa[0];
+	buffer[1] = card->atqa[1];
+	buffer[2] = sak;
+	memcpy(buffer+3, card->uid, card->uidLength);
+	memcpy(activeUid, card->uid, card->uidLength);
+	activeUidLength = card->uidLength;
+	activeSak = sak;
+	cardSupportIsoDep = ((sak & 0x20) != 0);
+	card->lastSeen = millis();
+	activeCard = card;
+	return card->uidLength;
+}
+
+/*
+ * With the card cache enabled, first try to reactivate the most recently seen card,
+ * which costs a WUPA and a SELECT. If another card is in the field, the full
+ * activation follows.
+ */
+uint8_t PN5180ISO14443::activateRecentOrNewCard(uint8_t *buffer) {
+	if (cardCacheEnabled) {
+		ISO14443CardInfo *recent = NULL;
+		for (int i = 0; i < ISO14443_CARD_CACHE_SIZE; i++) {
+			if ((0 != cardCache[i].uidLength) && ((NULL == recent) || (cardCache[i].lastSeen > recent->lastSeen)))
+			  recent = &cardCache[i];
+		}
+		if (NULL != recent) {
+			uint8_t uidLength = reactivateTypeA(recent->uid, recent->uidLength, buffer);
+			if (uidLength > 0)
+			  return uidLength;
+		}
+	}
+	return activateTypeA(buffer, 1);
+}
+
+void PN5180ISO14443::setCardCacheEnabled(bool enabled) {
+	cardCacheEnabled = enabled;
+}
+
+void PN5180ISO14443::clearCardCache() {
+	for (int i = 0; i < ISO14443_CARD_CACHE_SIZE; i++) {
+		cardCache[i].uidLength = 0;
+	}
+	activeCard = NULL;
+}
+
+/*
+ * Cached activation data of the active card, NULL if no card is active.
+ */
+const ISO14443CardInfo *PN5180ISO14443::getCardInfo() {
+	return activeCard;
+}
 
-    return data_len;
+bool PN5180ISO14443::piccSupportIsoDep() {
+	return cardSupportIsoDep;
+}
+
+/*--------------------Byte conversion voids--------------------*/
+
+size_t PN5180ISO14443::hexStringToByteArray(const String& s, uint8_t* data_out) {
+    // data_out must hold (s.length()+1)/2 bytes, returns 0 for non-hex input
+    int len = hexDecode(s.c_str(), s.length(), data_out, (s.length()+1) / 2);
+    return (len < 0) ? 0 : (size_t)len;
 }
 
 String PN5180ISO14443::bytesToHex(unsigned char* data, unsigned int len) {
-  String hexString = "";
-  for (unsigned int i = 0; i < len; i++) {
-    char temp[3]; // 2 chars for hex, 1 for null terminator
-    sprintf(temp, "%02X", data[i]);
-    hexString += temp;
+  String hexString;
+  hexString.reserve(2*len);
+  char chunk[2*16+1];
+  for (unsigned int i = 0; i < len; i += 16) {
+    unsigned int n = ((len - i) < 16) ? (len - i) : 16;
+    hexEncode(data+i, n, chunk, sizeof(chunk));
+    hexString += chunk;
   }
   return hexString;
 }
@@ -21,31 +21,143 @@
 
 #include "PN5180.h"
 
+// MIFARE Classic 4K has 40 sectors, reduce for 1K/Mini cards to save RAM
+#ifndef MIFARE_CLASSIC_MAX_SECTORS
+#define MIFARE_CLASSIC_MAX_SECTORS  40
+#endif
+
+// FAST_READ page count per exchange: 126 pages + CRC fit into the 508 byte RX buffer
+#define NTAG_FAST_READ_MAX_PAGES    126
+
+// S(WTX) requests answered per APDU before the exchange is given up
+#ifndef ISO_DEP_MAX_WTX
+#define ISO_DEP_MAX_WTX             32
+#endif
+// blocks repeated per APDU after an R(NAK) or a wrong R(ACK) before the exchange is given up
+#ifndef ISO_DEP_MAX_RETRANSMISSIONS
+#define ISO_DEP_MAX_RETRANSMISSIONS 2
+#endif
+
+#define MIFARE_KEY_A                (0x60)
+#define MIFARE_KEY_B                (0x61)
+
+// number of recently seen cards kept for fast reactivation
+#ifndef ISO14443_CARD_CACHE_SIZE
+#define ISO14443_CARD_CACHE_SIZE    4
+#endif
+
+/*
+ * Activation data of a card seen before, used to reactivate it without anticollision.
+ */
+struct ISO14443CardInfo {
+  uint8_t uid[10];
+  uint8_t uidLength;    // 0 = unused entry
+  uint8_t atqa[2];
+  uint8_t sak;
+  uint8_t ats[20];
+  uint8_t atsLength;    // 0 = no ATS received yet
+  uint16_t fsc;         // max. frame size accepted by the card (FSCI of ATS)
+  uint8_t protocolOptions; // TC(1) of ATS: bit 1 = CID supported, bit 0 = NAD supported
+  unsigned long lastSeen;
+};
+
+/*
+ * ISO-DEP (ISO14443-4) state of one activated card. Several cards activated
+ * with different CIDs can be used at the same time, each with its own session.
+ */
+struct IsoDepSession {
+  uint8_t cid;          // card identifier 0..14 assigned with RATS
+  bool cidEnabled;      // CID byte is sent, required for cid != 0
+  bool nadEnabled;      // NAD byte is sent, set by the application if the card supports NAD
+  uint8_t nad;          // node address used when nadEnabled
+  uint8_t blockNumber;  // current PCD block number
+  uint16_t fsc;         // max. frame size accepted by the card
+  uint8_t protocolOptions; // TC(1) of ATS: bit 1 = CID supported, bit 0 = NAD supported
+  bool active;
+};
+
 class PN5180ISO14443 : public PN5180 {
 
 public:
   PN5180ISO14443(uint8_t SSpin, uint8_t BUSYpin, uint8_t RSTpin);
   
-private:
+protected:
   uint16_t rxBytesReceived();
-  bool lastPcbIs2 = false;
+  uint16_t transceive(uint8_t *cmd, uint8_t len, uint8_t validBits, uint16_t timeoutMs);
+  IsoDepSession defaultSession = { 0, false, false, 0, 0, 32, 0, false };
+
+private:
   bool cardSupportIsoDep = false;
+  uint8_t activeUid[10];
+  uint8_t activeUidLength = 0;
+  uint8_t activeSak = 0;
+  bool presenceCheckMode = false;
+  // MIFARE Classic key cache, keyType 0 = no key known for sector
+  uint8_t mifareKeys[MIFARE_CLASSIC_MAX_SECTORS][6];
+  uint8_t mifareKeyTypes[MIFARE_CLASSIC_MAX_SECTORS];
+  uint8_t authenticatedSector = 0xFF;
+  uint8_t mifareAckCommand(uint8_t *cmd, uint8_t len, uint16_t timeoutMs);
+  bool mifareValueOperation(uint8_t opcode, uint8_t blockNo, int32_t operand);
+  bool selectTypeA(const uint8_t *uid, uint8_t uidLength, uint8_t *sak);
+  uint16_t buildIBlock(IsoDepSession *session, const uint8_t *command, uint16_t commandLen,
+                       uint16_t *sentLen, uint16_t maxInf, uint8_t *frame);
+  bool wakeupTypeA(const uint8_t *uid, uint8_t uidLength, uint8_t *sak);
+  ISO14443CardInfo cardCache[ISO14443_CARD_CACHE_SIZE];
+  ISO14443CardInfo *activeCard = NULL;
+  bool cardCacheEnabled = false;
+  ISO14443CardInfo *findCachedCard(const uint8_t *uid, uint8_t uidLength);
+  ISO14443CardInfo *cacheCard(const uint8_t *buffer, uint8_t uidLength);
+  void parseAts(ISO14443CardInfo *card, const uint8_t *ats, uint8_t len);
+  uint8_t activateRecentOrNewCard(uint8_t *buffer);
 public:
   bool piccSupportIsoDep();
   uint8_t activateTypeA(uint8_t *buffer, uint8_t kind);
+  uint8_t reactivateTypeA(const uint8_t *uid, uint8_t uidLength, uint8_t *buffer);
+  void setCardCacheEnabled(bool enabled);
+  void clearCardCache();
+  const ISO14443CardInfo *getCardInfo();
   bool mifareBlockRead(uint8_t blockno,uint8_t *buffer);
   uint8_t mifareBlockWrite16(uint8_t blockno, uint8_t *buffer);
   bool mifareHalt();
 
+  void mifareSetKey(uint8_t sector, uint8_t keyType, const uint8_t *key);
+  bool mifareClassicAuthenticate(uint8_t blockNo);
+  bool mifareClassicReadSector(uint8_t sector, uint8_t *buffer);
+  uint8_t mifareClassicReadCard(uint8_t *buffer, uint8_t numSectors);
+  bool mifareClassicWriteBlock(uint8_t blockNo, uint8_t *buffer);
+  bool mifareClassicWriteSector(uint8_t sector, uint8_t *buffer);
+  bool mifareValueRead(uint8_t blockNo, int32_t *value);
+  bool mifareValueWrite(uint8_t blockNo, int32_t value);
+  bool mifareValueIncrement(uint8_t blockNo, int32_t delta);
+  bool mifareValueDecrement(uint8_t blockNo, int32_t delta);
+  bool mifareValueRestore(uint8_t blockNo);
+  bool mifareValueTransfer(uint8_t blockNo);
+  static uint8_t mifareSectorOfBlock(uint8_t blockNo);
+  static uint8_t mifareFirstBlockOfSector(uint8_t sector);
+  static uint8_t mifareBlocksInSector(uint8_t sector);
+
+  bool ntagGetVersion(uint8_t *version);
+  uint16_t ntagGetNumPages();
+  uint16_t ntagFastRead(uint8_t startPage, uint8_t endPage, uint8_t *buffer);
+  uint16_t ntagReadMemory(uint8_t *buffer, uint16_t maxLen);
+  bool ntagWritePage(uint8_t page, uint8_t *data);
+  uint8_t ntagWritePages(uint8_t startPage, uint8_t *data, uint8_t numPages);
+  bool ntagSyncPages(uint8_t startPage, uint8_t *image, uint8_t numPages, uint8_t *pagesWritten);
+
   bool startIsoDep();
   uint16_t exchangeApdu(uint8_t *apduCommand, uint8_t commandLen, uint8_t *responseBuffer, uint16_t maxResponseLen, uint8_t readDelay);
   bool closeIsoDep();
+  bool startIsoDep(IsoDepSession *session, uint8_t cid);
+  uint16_t exchangeApdu(IsoDepSession *session, uint8_t *apduCommand, uint8_t commandLen, uint8_t *responseBuffer, uint16_t maxResponseLen, uint8_t readDelay);
+  bool closeIsoDep(IsoDepSession *session);
   bool typeAHalt();
 
   bool setupRF();
   uint8_t readCardSerial(uint8_t *buffer);
   bool isCardPresent();
   bool isIsoDepCardPresent();
+  bool presenceCheck();
+  void setPresenceCheckMode(bool enabled);
 
   size_t remove_first_element(uint8_t* buffer, size_t currentSize);
   size_t hexStringToByteArray(const String& s, uint8_t* data_out);
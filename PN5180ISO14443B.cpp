@@ -0,0 +1,234 @@
+// NAME: PN5180ISO14443B.cpp
+//
+// DESC: ISO14443 Type B protocol on NXP Semiconductors PN5180 module for Arduino.
+//
+// Copyright (c) 2026 by HOCC2011. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+//#define DEBUG 1
+
+#include <Arduino.h>
+#include "PN5180ISO14443B.h"
+#include "Debug.h"
+
+#define ISO14443B_CMD_REQB      0x05  // also APf of WUPB and the slot markers
+#define ISO14443B_CMD_ATTRIB    0x1D
+#define ISO14443B_CMD_HLTB      0x50
+#define ISO14443B_ATQB          0x50
+#define ISO14443B_PARAM_WUPB    0x08
+
+// ATQB, ATTRIB and HLTB answers arrive within a few ms
+#define ISO14443B_TIMEOUT       5
+
+#define ATQB_RESULT_NONE        0
+#define ATQB_RESULT_CARD        1
+#define ATQB_RESULT_COLLISION   2
+
+PN5180ISO14443B::PN5180ISO14443B(uint8_t SSpin, uint8_t BUSYpin, uint8_t RSTpin)
+                : PN5180ISO14443(SSpin, BUSYpin, RSTpin) {
+}
+
+/*
+ * Load the Type B 106 kbit/s RF configuration. Type B frames always carry a
+ * CRC_B, so CRC is switched on for both directions.
+ */
+bool PN5180ISO14443B::loadTypeBConfig() {
+  if (!loadRFConfig(0x04, 0x84)) {  // ISO14443 Type B parameters
+    return false;
+  }
+  writeRegisterWithAndMask(SYSTEM_CONFIG, 0xFFFFFFBF);  // Switch off Crypto
+  writeRegisterWithOrMask(CRC_TX_CONFIG, 0x01);
+  writeRegisterWithOrMask(CRC_RX_CONFIG, 0x01);
+  return true;
+}
+
+/*
+ * Switch the field on with the Type B configuration. Only needed once,
+ * pollTypeB() and activateTypeB() load the configuration themselves.
+ */
+bool PN5180ISO14443B::setupRFTypeB() {
+  PN5180DEBUG(F("Loading RF-Configuration...\n"));
+  if (loadTypeBConfig()) {
+    PN5180DEBUG(F("done.\n"));
+  }
+  else return false;
+
+  PN5180DEBUG(F("Turning ON RF field...\n"));
+  if (setRF_on()) {
+    PN5180DEBUG(F("done.\n"));
+  }
+  else return false;
+
+  return true;
+}
+
+/*
+ * Send REQB/WUPB or a slot marker and read the ATQB:
+ * 50 | PUPI (4) | application data (4) | protocol info (3)
+ *
+ * Two cards answering in the same slot garble each other, the PN5180 flags
+ * that as CRC or collision error in RX_STATUS.
+ */
+uint8_t PN5180ISO14443B::receiveAtqb(uint8_t *cmd, uint8_t len, ISO14443BCardInfo *card) {
+  static const uint16_t fscTable[] = { 16, 24, 32, 40, 48, 64, 96, 128, 256 };
+
+  uint16_t rxLen = transceive(cmd, len, 0x00, ISO14443B_TIMEOUT);
+  if (0 == rxLen) {
+    return ATQB_RESULT_NONE;
+  }
+  uint32_t rxStatus;
+  readRegister(RX_STATUS, &rxStatus);
+  if ((rxStatus & (RX_DATA_INTEGRITY_ERROR | RX_PROTOCOL_ERROR | RX_COLLISION_DETECTED)) || (rxLen < 12)) {
+    PN5180DEBUG(F("ATQB collision\n"));
+    return ATQB_RESULT_COLLISION;
+  }
+
+  uint8_t atqb[12];
+  if ((0L == readData(sizeof(atqb), atqb)) || (ISO14443B_ATQB != atqb[0])) {
+    return ATQB_RESULT_COLLISION;
+  }
+  memcpy(card->pupi, &atqb[1], 4);
+  memcpy(card->applicationData, &atqb[5], 4);
+  memcpy(card->protocolInfo, &atqb[9], 3);
+  uint8_t fsci = atqb[10] >> 4;
+  card->fsc = (fsci < 9) ? fscTable[fsci] : 256;
+  card->fwi = atqb[11] >> 4;
+  // FO: bit 1 = NAD, bit 0 = CID supported
+  card->protocolOptions = ((atqb[11] & 0x01) << 1) | ((atqb[11] & 0x02) >> 1);
+  return ATQB_RESULT_CARD;
+}
+
+/*
+ * Collect the ATQBs of the cards in the field with time slot anticollision.
+ * The first round sends WUPB with 2^slotsExp slots, each card answers in a
+ * random slot, the following slots are opened with slot markers. If slots
+ * collided, the cards found so far are halted and the next round (REQB,
+ * which halted cards ignore) runs with twice the slots.
+ *
+ * Loads the Type B RF configuration, like activateTypeA() does for Type A.
+ * Found cards may be left in HALT state, activateTypeB() wakes them again.
+ *
+ * return value: number of cards in cards[]
+ */
+uint8_t PN5180ISO14443B::pollTypeB(ISO14443BCardInfo *cards, uint8_t maxCards, uint8_t slotsExp, uint8_t afi) {
+  if (!loadTypeBConfig()) {
+    return 0;
+  }
+  uint8_t numCards = 0;
+  if (slotsExp > 4) slotsExp = 4;
+
+  for (int round=0; (round < ISO14443B_MAX_POLL_ROUNDS) && (numCards < maxCards); round++) {
+    bool collision = false;
+    uint8_t firstNew = numCards;
+    uint8_t numSlots = 1 << slotsExp;
+    uint8_t reqb[3] = { ISO14443B_CMD_REQB, afi, (uint8_t)(((0 == round) ? ISO14443B_PARAM_WUPB : 0x00) | slotsExp) };
+
+    for (int slot=0; (slot < numSlots) && (numCards < maxCards); slot++) {
+      uint8_t rc;
+      if (0 == slot) {
+        rc = receiveAtqb(reqb, sizeof(reqb), &cards[numCards]);
+      }
+      else {
+        // slot marker APn: slot number - 1 in the high nibble
+        uint8_t marker = (slot << 4) | ISO14443B_CMD_REQB;
+        rc = receiveAtqb(&marker, 1, &cards[numCards]);
+      }
+      if (ATQB_RESULT_CARD == rc) {
+        numCards++;
+      }
+      else if (ATQB_RESULT_COLLISION == rc) {
+        collision = true;
+      }
+    }
+
+    if (!collision) {
+      break;
+    }
+    for (int i=firstNew; i<numCards; i++) {
+      haltTypeB(cards[i].pupi);
+    }
+    if (slotsExp < 4) slotsExp++;
+  }
+
+  PN5180DEBUG(F("Type B cards found: "));
+  PN5180DEBUG(numCards);
+  PN5180DEBUG(F("\n"));
+  return numCards;
+}
+
+/*
+ * Select a card with ATTRIB and start the ISO-DEP session on it.
+ * WUPB first brings the card back to READY in case it was halted by
+ * pollTypeB(), the PUPI in ATTRIB then addresses this card only.
+ *
+ * ATTRIB parameters: default TR0/TR1 and SOF/EOF, FSD 256, 106 kbit/s,
+ * protocol type taken from the ATQB, CID in param 4.
+ */
+bool PN5180ISO14443B::activateTypeB(const ISO14443BCardInfo *card, IsoDepSession *session, uint8_t cid) {
+  if ((cid > 14) || ((0 != cid) && (0 == (card->protocolOptions & 0x02)))) {
+    PN5180DEBUG(F("PICC doesn't support CID.\n"));
+    return false;
+  }
+  session->active = false;
+  if (!loadTypeBConfig()) {
+    return false;
+  }
+
+  uint8_t wupb[3] = { ISO14443B_CMD_REQB, 0x00, ISO14443B_PARAM_WUPB };
+  transceive(wupb, sizeof(wupb), 0x00, ISO14443B_TIMEOUT);
+
+  uint8_t attrib[9] = {
+    ISO14443B_CMD_ATTRIB,
+    card->pupi[0], card->pupi[1], card->pupi[2], card->pupi[3],
+    0x00,
+    0x08,
+    (uint8_t)(card->protocolInfo[1] & 0x0F),
+    cid
+  };
+  if (0 == transceive(attrib, sizeof(attrib), 0x00, ISO14443B_TIMEOUT)) {
+    PN5180DEBUG(F("No answer to ATTRIB.\n"));
+    return false;
+  }
+  // answer: MBLI | CID
+  uint8_t answer;
+  if ((0L == readData(1, &answer)) || ((answer & 0x0F) != cid)) {
+    return false;
+  }
+
+  session->cid = cid;
+  session->cidEnabled = (0 != cid);
+  session->nadEnabled = false;
+  session->nad = 0;
+  session->blockNumber = 0;
+  session->fsc = card->fsc;
+  session->protocolOptions = card->protocolOptions;
+  session->active = true;
+  return true;
+}
+
+bool PN5180ISO14443B::activateTypeB(const ISO14443BCardInfo *card) {
+  return activateTypeB(card, &defaultSession, 0);
+}
+
+/*
+ * HLTB, the card answers 00 and ignores everything but WUPB afterwards.
+ */
+bool PN5180ISO14443B::haltTypeB(const uint8_t *pupi) {
+  uint8_t hltb[5] = { ISO14443B_CMD_HLTB, pupi[0], pupi[1], pupi[2], pupi[3] };
+  if (0 == transceive(hltb, sizeof(hltb), 0x00, ISO14443B_TIMEOUT)) {
+    return false;
+  }
+  uint8_t answer;
+  return ((0L != readData(1, &answer)) && (0x00 == answer));
+}
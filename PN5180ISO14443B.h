@@ -0,0 +1,65 @@
+// NAME: PN5180ISO14443B.h
+//
+// DESC: ISO14443 Type B protocol on NXP Semiconductors PN5180 module for Arduino.
+//
+// Copyright (c) 2026 by HOCC2011. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+#ifndef PN5180ISO14443B_H
+#define PN5180ISO14443B_H
+
+#include "PN5180ISO14443.h"
+
+// polling rounds with growing slot count while collisions are seen
+#ifndef ISO14443B_MAX_POLL_ROUNDS
+#define ISO14443B_MAX_POLL_ROUNDS 4
+#endif
+
+/*
+ * Card data from the ATQB.
+ */
+struct ISO14443BCardInfo {
+  uint8_t pupi[4];            // pseudo unique PICC identifier
+  uint8_t applicationData[4];
+  uint8_t protocolInfo[3];    // bit rates, max frame size | protocol type, FWI | ADC | FO
+  uint16_t fsc;               // max. frame size accepted by the card
+  uint8_t fwi;                // frame waiting time integer
+  uint8_t protocolOptions;    // as in IsoDepSession: bit 1 = CID supported, bit 0 = NAD supported
+};
+
+/*
+ * Type B shares the ISO-DEP block protocol with Type A: after ATTRIB the
+ * exchangeApdu()/closeIsoDep() methods of PN5180ISO14443 are used as is.
+ * pollTypeB() and activateTypeB() load the Type B RF configuration, as
+ * activateTypeA() loads the Type A one, so both can be polled alternately
+ * once the field is on.
+ */
+class PN5180ISO14443B : public PN5180ISO14443 {
+
+public:
+  PN5180ISO14443B(uint8_t SSpin, uint8_t BUSYpin, uint8_t RSTpin);
+
+private:
+  bool loadTypeBConfig();
+  uint8_t receiveAtqb(uint8_t *cmd, uint8_t len, ISO14443BCardInfo *card);
+
+public:
+  bool setupRFTypeB();
+  uint8_t pollTypeB(ISO14443BCardInfo *cards, uint8_t maxCards, uint8_t slotsExp = 2, uint8_t afi = 0x00);
+  bool activateTypeB(const ISO14443BCardInfo *card);
+  bool activateTypeB(const ISO14443BCardInfo *card, IsoDepSession *session, uint8_t cid);
+  bool haltTypeB(const uint8_t *pupi);
+};
+
+#endif /* PN5180ISO14443B_H */
@@ -22,8 +22,18 @@
 #include "PN5180ISO15693.h"
 #include "Debug.h"
 
+// an answer starts t1 (about 0.3ms) after the EOF opening a slot, plus margin
+#define ISO15693_SOF_TIMEOUT        1
+// response time t1 plus margin, see responseTimeout()
+#define ISO15693_RESPONSE_TIMEOUT   2
+// programming time of one block for write and lock commands, see programmingTime()
+#define ISO15693_WRITE_TIMEOUT      20
+// longest frame: 508 bytes at 26kbit/s
+#define ISO15693_RX_TIMEOUT         200
+
 PN5180ISO15693::PN5180ISO15693(uint8_t SSpin, uint8_t BUSYpin, uint8_t RSTpin)
               : PN5180(SSpin, BUSYpin, RSTpin) {
+  clearRandomCache();
 }
 
 /*
@@ -69,6 +79,387 @@ ISO15693ErrorCode PN5180ISO15693::getInventory(uint8_t *uid) {
   return ISO15693_EC_OK;
 }
 
+/*
+ * Inventory with 16 slots, code=01
+ *
+ * Every tag whose UID matches the mask answers in the slot given by the next
+ * 4 bits of its UID. The slots 1..15 are opened by sending a bare EOF.
+ * Slots with more than one answer are resolved by a new inventory with the
+ * mask extended by the slot number, until every tag had a slot for itself.
+ *
+ * Only tags of application family afi answer (0 = all tags), and only tags
+ * whose UID starts (LSB first) with the maskLen bits of mask. Filtering in
+ * the request keeps tags of no interest silent, saving air time and slots.
+ *
+ * uids must hold 8 bytes per tag, dsfids (optional, may be NULL) one byte.
+ *
+ * return value: EC_NO_CARD if no tag answered, ISO15693_EC_UNKNOWN_ERROR if a
+ * request could not be sent, ISO15693_EC_OK otherwise
+ */
+ISO15693ErrorCode PN5180ISO15693::getInventoryMultiple(uint8_t *uids, uint8_t *dsfids, uint8_t maxTags, uint8_t *numTags,
+                                                       uint8_t afi, const uint8_t *mask, uint8_t maskLen) {
+  PN5180DEBUG(F("Get Inventory (16 slots)...\n"));
+
+  *numTags = 0;
+  if (maskLen > ISO15693_MAX_MASK_LEN) {
+    return ISO15693_EC_OPTION_NOT_SUPPORTED;
+  }
+
+  uint8_t startMask[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+  if (NULL != mask) {
+    memcpy(startMask, mask, (maskLen + 7) / 8);
+    if (maskLen % 8) {
+      startMask[maskLen / 8] &= (1 << (maskLen % 8)) - 1;
+    }
+  }
+  else maskLen = 0;
+
+  ISO15693InventoryScan scan = { 0x01, afi, 0, 0, uids, dsfids, NULL, 0, maxTags, numTags };
+  if (!inventoryRound(&scan, startMask, maskLen)) {
+    return ISO15693_EC_UNKNOWN_ERROR;
+  }
+
+  PN5180DEBUG(F("Tags found: "));
+  PN5180DEBUG(*numTags);
+  PN5180DEBUG("\n");
+
+  return (0 == *numTags) ? EC_NO_CARD : ISO15693_EC_OK;
+}
+
+ISO15693ErrorCode PN5180ISO15693::getInventoryMultiple(uint8_t *uids, uint8_t *dsfids, uint8_t maxTags, uint8_t *numTags) {
+  return getInventoryMultiple(uids, dsfids, maxTags, numTags, 0x00, NULL, 0);
+}
+
+/*
+ * ICODE Inventory Read, code=A0, and Fast Inventory Read, code=B0
+ *
+ * Request format: SOF, Req.Flags, InventoryRead, IC Mfg code, AFI (opt.), Mask len, Mask value,
+ *                 FirstBlockNumber, NumBlocks-1, CRC16, EOF
+ * Response format (option flag set):
+ *    SOF, Resp.Flags, UID bytes not covered by mask and slot number, BlockData, CRC16, EOF
+ *
+ * A 16 slot inventory like getInventoryMultiple() where every tag sends
+ * numBlocks blocks starting at firstBlock along with its UID. blockData must
+ * hold numBlocks*blockSize bytes per tag, in the order of uids. With a fast
+ * RF profile, the tags answer with 53kbit/s (Fast Inventory Read, all ICODE
+ * SLIX tags support it). Tags of other vendors don't answer at all.
+ *
+ * return value: EC_NO_CARD if no tag answered, ISO15693_EC_UNKNOWN_ERROR if a
+ * request could not be sent, ISO15693_EC_OK otherwise
+ */
+ISO15693ErrorCode PN5180ISO15693::getInventoryRead(uint8_t *uids, uint8_t *blockData, uint8_t firstBlock, uint8_t numBlocks, uint8_t blockSize,
+                                                   uint8_t maxTags, uint8_t *numTags, uint8_t afi) {
+  PN5180DEBUG(F("Get Inventory Read (16 slots)...\n"));
+
+  *numTags = 0;
+  uint16_t dataLen = numBlocks * blockSize;
+  if ((0 == numBlocks) || (1 + 8 + dataLen > 508)) {
+    return ISO15693_EC_OPTION_NOT_SUPPORTED;
+  }
+
+  bool fast = (rfProfile & ISO15693_PROFILE_FAST);
+  if (fast && !loadRFConfig(profileTxConf(), 0x8e)) {  // receive with 53kbit/s
+    return ISO15693_EC_UNKNOWN_ERROR;
+  }
+
+  uint8_t startMask[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+  ISO15693InventoryScan scan = { (uint8_t)(fast ? 0xB0 : 0xA0), afi, firstBlock, numBlocks, uids, NULL, blockData, dataLen, maxTags, numTags };
+  bool success = inventoryRound(&scan, startMask, 0);
+
+  if (fast) {
+    loadRFConfig(profileTxConf(), 0x8d);
+  }
+  if (!success) {
+    return ISO15693_EC_UNKNOWN_ERROR;
+  }
+
+  PN5180DEBUG(F("Tags found: "));
+  PN5180DEBUG(*numTags);
+  PN5180DEBUG("\n");
+
+  return (0 == *numTags) ? EC_NO_CARD : ISO15693_EC_OK;
+}
+
+/*
+ * One inventory round with the mask given, recursing into collided slots.
+ * A slot is only waited for until its answer should have started, the end
+ * of the frame only when an SOF was detected.
+ *
+ * Request format: SOF, Req.Flags, Inventory, AFI (opt.), Mask len, Mask value, CRC16, EOF
+ * The mask value is sent LSB first, with as many bytes as the mask length needs.
+ *
+ * return value: false if a request could not be sent
+ */
+bool PN5180ISO15693::inventoryRound(ISO15693InventoryScan *scan, uint8_t *mask, uint8_t maskLen) {
+  bool inventoryRead = (0x01 != scan->command);
+  uint8_t inventory[7 + 8];
+  uint8_t maskBytes = (maskLen + 7) / 8;
+  uint8_t pos = 0;
+  // inventory flag + high data rate, 16 slots, AFI field if filtered, option flag: answer with UID
+  inventory[pos++] = 0x06 | ((0 != scan->afi) ? 0x10 : 0x00) | (inventoryRead ? 0x40 : 0x00);
+  inventory[pos++] = scan->command;
+  if (inventoryRead) {
+    inventory[pos++] = 0x04;  // NXP
+  }
+  if (0 != scan->afi) {
+    inventory[pos++] = scan->afi;
+  }
+  inventory[pos++] = maskLen;
+  for (int i=0; i<maskBytes; i++) {
+    inventory[pos++] = mask[i];
+  }
+  if (inventoryRead) {
+    inventory[pos++] = scan->firstBlock;
+    inventory[pos++] = scan->numBlocks - 1;
+  }
+
+  // the tag sends the UID bytes not known from mask and slot number
+  uint8_t uidBytes = inventoryRead ? (8 - (maskLen + 4) / 8) : 8;
+  uint16_t expectedLen = inventoryRead ? (1 + uidBytes + scan->dataLen) : 10;
+
+  uint32_t txConfig;
+  readRegister(TX_CONFIG, &txConfig);
+
+  uint16_t collisions = 0;
+  for (int slot=0; slot<16; slot++) {
+    clearIRQStatus(RX_SOF_DET_IRQ_STAT | IDLE_IRQ_STAT | TX_IRQ_STAT | RX_IRQ_STAT);
+    uint16_t sofTimeout = ISO15693_SOF_TIMEOUT;
+    bool sent;
+    if (0 == slot) {
+      sent = sendData(inventory, pos);
+      sofTimeout = responseTimeout(inventory, pos);  // the request is still on air
+    }
+    else {
+      if (1 == slot) {
+        writeRegisterWithAndMask(TX_CONFIG, 0xFFFFFB3F);  // no SOF, no data: send EOF only
+      }
+      sent = sendData(inventory, 0);
+    }
+    if (!sent) {
+      PN5180DEBUG(F("*** ERROR: inventory request not sent!\n"));
+      writeRegister(TX_CONFIG, txConfig);
+      return false;
+    }
+
+    uint32_t irqStatus = waitForIRQ(RX_SOF_DET_IRQ_STAT | RX_IRQ_STAT, sofTimeout);
+    if (0 == (irqStatus & (RX_SOF_DET_IRQ_STAT | RX_IRQ_STAT))) {
+      continue;  // empty slot
+    }
+    if (0 == (irqStatus & RX_IRQ_STAT)) {  // the answer started, wait for its end
+      irqStatus = waitForIRQ(RX_IRQ_STAT, ISO15693_RX_TIMEOUT);
+    }
+
+    uint32_t rxStatus;
+    readRegister(RX_STATUS, &rxStatus);
+    uint16_t len = (uint16_t)(rxStatus & 0x000001ff);
+    uint8_t *response = NULL;
+    if ((0 == (irqStatus & RX_IRQ_STAT)) ||
+        (rxStatus & (RX_DATA_INTEGRITY_ERROR | RX_PROTOCOL_ERROR | RX_COLLISION_DETECTED)) ||
+        (0 == len) || (0L == (response = readData(len)))) {
+      PN5180DEBUG(F("Collision in slot "));
+      PN5180DEBUG(slot);
+      PN5180DEBUG("\n");
+      collisions |= (1 << slot);
+      continue;
+    }
+    // a clean error answer (flags, error code), e.g. blocks out of range:
+    // the tag answers the same way on every mask level, don't descend
+    if (response[0] & (1<<0)) { // error flag
+      PN5180DEBUG(F("Error answer in slot "));
+      PN5180DEBUG(slot);
+      PN5180DEBUG("\n");
+      continue;
+    }
+    if (len != expectedLen) {
+      PN5180DEBUG(F("Collision in slot "));
+      PN5180DEBUG(slot);
+      PN5180DEBUG("\n");
+      collisions |= (1 << slot);
+      continue;
+    }
+
+    uint8_t uid[8];
+    if (inventoryRead) {
+      memcpy(uid, mask, 8);
+      setSlotBits(uid, maskLen, slot);
+      memcpy(&uid[8 - uidBytes], &response[1], uidBytes);
+    }
+    else {
+      memcpy(uid, &response[2], 8);
+    }
+
+    bool known = false;
+    for (int i=0; (i < *scan->numTags) && !known; i++) {
+      known = (0 == memcmp(&scan->uids[8*i], uid, 8));
+    }
+    if (!known && (*scan->numTags < scan->maxTags)) {
+      uint8_t n = *scan->numTags;
+      memcpy(&scan->uids[8*n], uid, 8);
+      if (NULL != scan->dsfids) {
+        scan->dsfids[n] = response[1];
+      }
+      if (NULL != scan->blockData) {
+        memcpy(&scan->blockData[n * scan->dataLen], &response[1 + uidBytes], scan->dataLen);
+      }
+      (*scan->numTags)++;
+    }
+  }
+
+  writeRegister(TX_CONFIG, txConfig);
+  clearIRQStatus(RX_SOF_DET_IRQ_STAT | IDLE_IRQ_STAT | TX_IRQ_STAT | RX_IRQ_STAT);
+
+  if (maskLen + 4 > ISO15693_MAX_MASK_LEN) {
+    return true;
+  }
+  for (int slot=0; (slot<16) && (*scan->numTags < scan->maxTags); slot++) {
+    if (0 == (collisions & (1 << slot))) {
+      continue;
+    }
+    uint8_t subMask[8];
+    memcpy(subMask, mask, sizeof(subMask));
+    setSlotBits(subMask, maskLen, slot);
+    if (!inventoryRound(scan, subMask, maskLen + 4)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * The slot number is the next 4 bits of the UID after the mask, possibly
+ * crossing a byte.
+ */
+void PN5180ISO15693::setSlotBits(uint8_t *uid, uint8_t maskLen, uint8_t slot) {
+  uint16_t bits = slot << (maskLen % 8);
+  uid[maskLen / 8] |= bits & 0xFF;
+  if (bits > 0xFF) {
+    uid[maskLen / 8 + 1] |= bits >> 8;
+  }
+}
+
+/*
+ * Stay quiet, code=02
+ *
+ * Request format: SOF, Req.Flags, StayQuiet, UID, CRC16, EOF
+ * The VICC does not answer, it goes to QUIET state and only processes
+ * addressed requests from then on, inventories are ignored.
+ */
+ISO15693ErrorCode PN5180ISO15693::stayQuiet(uint8_t *uid) {
+  //                      flags, cmd, uid
+  uint8_t stayQuiet[] = { 0x22, 0x02, 1,2,3,4,5,6,7,8 }; // UID has LSB first!
+  //                        |\- high data rate
+  //                        \-- no options, addressed by UID
+  for (int i=0; i<8; i++) {
+    stayQuiet[2+i] = uid[i];
+  }
+
+  PN5180DEBUG(F("Stay Quiet...\n"));
+
+  clearIRQStatus(RX_SOF_DET_IRQ_STAT | IDLE_IRQ_STAT | TX_IRQ_STAT | RX_IRQ_STAT);
+  if (!sendData(stayQuiet, sizeof(stayQuiet))) {
+    return ISO15693_EC_UNKNOWN_ERROR;
+  }
+  uint32_t status = waitForIRQ(TX_IRQ_STAT, responseTimeout(stayQuiet, sizeof(stayQuiet)));
+  clearIRQStatus(RX_SOF_DET_IRQ_STAT | IDLE_IRQ_STAT | TX_IRQ_STAT | RX_IRQ_STAT);
+  return (status & TX_IRQ_STAT) ? ISO15693_EC_OK : ISO15693_EC_UNKNOWN_ERROR;
+}
+
+/*
+ * Select, code=25
+ *
+ * Request format: SOF, Req.Flags, Select, UID, CRC16, EOF
+ * Response format: SOF, Resp.Flags, CRC16, EOF
+ *
+ * The addressed VICC goes to SELECTED state, any other VICC in SELECTED
+ * state returns to READY. The selected VICC processes requests sent with
+ * the select flag (0x10) instead of a UID.
+ */
+ISO15693ErrorCode PN5180ISO15693::selectTag(uint8_t *uid) {
+  //                   flags, cmd, uid
+  uint8_t select[] = { 0x22, 0x25, 1,2,3,4,5,6,7,8 }; // UID has LSB first!
+  for (int i=0; i<8; i++) {
+    select[2+i] = uid[i];
+  }
+
+  PN5180DEBUG(F("Select...\n"));
+
+  uint8_t *resultPtr;
+  return issueISO15693Command(select, sizeof(select), &resultPtr);
+}
+
+/*
+ * Reset to ready, code=26
+ *
+ * Request format: SOF, Req.Flags, ResetToReady, UID (opt.), CRC16, EOF
+ * Response format: SOF, Resp.Flags, CRC16, EOF
+ *
+ * Brings a quiet or selected VICC back to READY state. With uid NULL, the
+ * request is sent to the selected VICC.
+ */
+ISO15693ErrorCode PN5180ISO15693::resetToReady(uint8_t *uid) {
+  //                         flags, cmd, uid
+  uint8_t resetToReady[] = { 0x22, 0x26, 1,2,3,4,5,6,7,8 }; // UID has LSB first!
+  uint8_t len = sizeof(resetToReady);
+  if (NULL == uid) {
+    resetToReady[0] = 0x12;  // high data rate, select flag
+    len = 2;
+  }
+  else {
+    for (int i=0; i<8; i++) {
+      resetToReady[2+i] = uid[i];
+    }
+  }
+
+  PN5180DEBUG(F("Reset to Ready...\n"));
+
+  uint8_t *resultPtr;
+  return issueISO15693Command(resetToReady, len, &resultPtr);
+}
+
+/*
+ * Start working through the tags in the field, only tags of application
+ * family afi take part (0 = all tags). The RF field is switched off for a
+ * moment, which brings all tags, quiet ones included, back to READY.
+ */
+bool PN5180ISO15693::startSession(ISO15693Session *session, uint8_t afi) {
+  session->afi = afi;
+  session->numTags = 0;
+  session->processedTags = 0;
+  if (!setRF_off()) {
+    return false;
+  }
+  clearRandomCache();
+  delay(2);  // tags lose their state after about 1ms without field
+  return setRF_on();
+}
+
+/*
+ * One round of a session: inventory the tags still in READY state, hand each
+ * one to callback and quiet it afterwards. Quiet tags don't take part in the
+ * inventory anymore, so a round only costs the new arrivals plus one empty
+ * inventory. Call this repeatedly while tags pass the antenna.
+ *
+ * return value: number of tags processed and quieted in this round
+ */
+uint8_t PN5180ISO15693::inventorySession(ISO15693Session *session, ISO15693TagCallback callback, void *context) {
+  session->numTags = 0;
+  if (ISO15693_EC_OK != getInventoryMultiple(&session->uids[0][0], session->dsfids, ISO15693_SESSION_MAX_TAGS, &session->numTags, session->afi, NULL, 0)) {
+    return 0;
+  }
+
+  uint8_t processed = 0;
+  for (int i=0; i<session->numTags; i++) {
+    if (!callback(this, session->uids[i], session->dsfids[i], context)) {
+      continue;
+    }
+    if (ISO15693_EC_OK == stayQuiet(session->uids[i])) {
+      processed++;
+    }
+  }
+  session->processedTags += processed;
+  return processed;
+}
+
 /*
  * Read single block, code=20
  *
@@ -179,23 +570,12 @@ ISO15693ErrorCode PN5180ISO15693::readSingleBlock(uint8_t *uid, uint8_t blockNo,
  *    SOF, Resp.Flags, CRC16, EOF
  */
 ISO15693ErrorCode PN5180ISO15693::writeSingleBlock(uint8_t *uid, uint8_t blockNo, uint8_t *blockData, uint8_t blockSize) {
-  //                            flags, cmd, uid,             blockNo
-  uint8_t writeSingleBlock[] = { 0x22, 0x21, 1,2,3,4,5,6,7,8, blockNo }; // UID has LSB first!
-  //                               |\- high data rate
-  //                               \-- no options, addressed by UID
-
-  uint8_t writeCmdSize = sizeof(writeSingleBlock) + blockSize;
-  uint8_t *writeCmd = (uint8_t*)malloc(writeCmdSize);
-  uint8_t pos = 0;
-  writeCmd[pos++] = writeSingleBlock[0];
-  writeCmd[pos++] = writeSingleBlock[1];
-  for (int i=0; i<8; i++) {
-    writeCmd[pos++] = uid[i];
-  }
-  writeCmd[pos++] = blockNo;
-  for (int i=0; i<blockSize; i++) {
-    writeCmd[pos++] = blockData[i];
+  if (blockSize > 32) {
+    return ISO15693_EC_OPTION_NOT_SUPPORTED;
   }
+  uint8_t pos = buildBlockCommand(0x21, uid, blockNo, 0, false);
+  memcpy(&commandBuffer[pos], blockData, blockSize);
+  pos += blockSize;
 
 #ifdef DEBUG
   PN5180DEBUG("Write Single Block #");
@@ -203,21 +583,437 @@ ISO15693ErrorCode PN5180ISO15693::writeSingleBlock(uint8_t *uid, uint8_t blockNo
   PN5180DEBUG(", size=");
   PN5180DEBUG(blockSize);
   PN5180DEBUG(":");
-  for (int i=0; i<writeCmdSize; i++) {
+  for (int i=0; i<pos; i++) {
     PN5180DEBUG(" ");
-    PN5180DEBUG(formatHex(writeCmd[i]));
+    PN5180DEBUG(formatHex(commandBuffer[i]));
   }
   PN5180DEBUG("\n");
 #endif
 
   uint8_t *resultPtr;
-  ISO15693ErrorCode rc = issueISO15693Command(writeCmd, writeCmdSize, &resultPtr);
+  return issueWriteCommand(pos, &resultPtr);
+}
+
+/*
+ * Read multiple blocks, code=23, and Extended read multiple blocks, code=33
+ *
+ * Request format: SOF, Req.Flags, ReadMultipleBlocks, UID (opt.), FirstBlockNumber, NumBlocks-1, CRC16, EOF
+ *   Extended: block number and count with 16 bit, LSB first
+ * Response format:
+ *  when ERROR flag is set:
+ *    SOF, Resp.Flags, ErrorCode, CRC16, EOF
+ *
+ *  when ERROR flag is NOT set:
+ *    SOF, Flags, BlockData (len=numBlocks*blockLength), CRC16, EOF
+ *
+ * The blocks are requested in as few commands as the 508 byte RX buffer of
+ * the PN5180 allows, blockData must hold numBlocks*blockSize bytes.
+ */
+ISO15693ErrorCode PN5180ISO15693::readBlocks(uint8_t *uid, uint16_t firstBlock, uint16_t numBlocks, uint8_t *blockData, uint8_t blockSize, bool extended) {
+  if ((0 == blockSize) || (0 == numBlocks) || ((uint32_t)firstBlock + numBlocks > (extended ? 65536UL : 256UL))) {
+    return ISO15693_EC_BLOCK_NOT_AVAILABLE;
+  }
+  uint16_t maxBlocks = (508 - 1) / blockSize;
+
+  for (uint16_t done=0; done<numBlocks; ) {
+    uint16_t n = numBlocks - done;
+    if (n > maxBlocks) n = maxBlocks;
+    uint16_t blockNo = firstBlock + done;
+
+    uint8_t pos = buildBlockCommand(extended ? 0x33 : 0x23, uid, blockNo, n, extended);
+
+    PN5180DEBUG(F("Read Multiple Blocks #"));
+    PN5180DEBUG(blockNo);
+    PN5180DEBUG(F(", count="));
+    PN5180DEBUG(n);
+    PN5180DEBUG("\n");
+
+    uint8_t *resultPtr;
+    uint16_t resultLen;
+    ISO15693ErrorCode rc = issueISO15693Command(commandBuffer, pos, &resultPtr, &resultLen);
+    if (ISO15693_EC_OK != rc) {
+      return rc;
+    }
+    if (resultLen != 1 + n * blockSize) {
+      PN5180DEBUG(F("*** ERROR: wrong block data length!\n"));
+      return ISO15693_EC_UNKNOWN_ERROR;
+    }
+    memcpy(blockData + done * blockSize, &resultPtr[1], n * blockSize);
+    done += n;
+  }
+
+  return ISO15693_EC_OK;
+}
+
+ISO15693ErrorCode PN5180ISO15693::readMultipleBlocks(uint8_t *uid, uint8_t firstBlock, uint16_t numBlocks, uint8_t *blockData, uint8_t blockSize) {
+  return readBlocks(uid, firstBlock, numBlocks, blockData, blockSize, false);
+}
+
+ISO15693ErrorCode PN5180ISO15693::readMultipleBlocksExtended(uint8_t *uid, uint16_t firstBlock, uint16_t numBlocks, uint8_t *blockData, uint8_t blockSize) {
+  return readBlocks(uid, firstBlock, numBlocks, blockData, blockSize, true);
+}
+
+/*
+ * Write multiple blocks, code=24, and Extended write multiple blocks, code=34
+ *
+ * Request format: SOF, Req.Flags, WriteMultipleBlocks, UID (opt.), FirstBlockNumber, NumBlocks-1, BlockData, CRC16, EOF
+ *   Extended: block number and count with 16 bit, LSB first
+ * Response format:
+ *  when ERROR flag is set:
+ *    SOF, Resp.Flags, ErrorCode, CRC16, EOF
+ *
+ *  when ERROR flag is NOT set:
+ *    SOF, Resp.Flags, CRC16, EOF
+ *
+ * Tags program all blocks of a command before they answer, the blocks are
+ * sent in pieces of ISO15693_MAX_WRITE_BLOCKS. Several tags (e.g. ICODE SLIX)
+ * don't implement this command and answer ISO15693_EC_NOT_SUPPORTED.
+ */
+ISO15693ErrorCode PN5180ISO15693::writeBlocks(uint8_t *uid, uint16_t firstBlock, uint16_t numBlocks, uint8_t *blockData, uint8_t blockSize, bool extended) {
+  if ((0 == blockSize) || (blockSize > 32) || (0 == numBlocks) || ((uint32_t)firstBlock + numBlocks > (extended ? 65536UL : 256UL))) {
+    return ISO15693_EC_BLOCK_NOT_AVAILABLE;
+  }
+  uint16_t maxBlocks = ISO15693_MAX_WRITE_BLOCKS;  // fits into commandBuffer for any block size
+
+  for (uint16_t done=0; done<numBlocks; ) {
+    uint16_t n = numBlocks - done;
+    if (n > maxBlocks) n = maxBlocks;
+    uint16_t blockNo = firstBlock + done;
+
+    uint8_t pos = buildBlockCommand(extended ? 0x34 : 0x24, uid, blockNo, n, extended);
+    memcpy(&commandBuffer[pos], blockData + done * blockSize, n * blockSize);
+    pos += n * blockSize;
+
+    PN5180DEBUG(F("Write Multiple Blocks #"));
+    PN5180DEBUG(blockNo);
+    PN5180DEBUG(F(", count="));
+    PN5180DEBUG(n);
+    PN5180DEBUG("\n");
+
+    uint8_t *resultPtr;
+    ISO15693ErrorCode rc = issueWriteCommand(pos, &resultPtr);
+    if (ISO15693_EC_OK != rc) {
+      return rc;
+    }
+    done += n;
+  }
+
+  return ISO15693_EC_OK;
+}
+
+ISO15693ErrorCode PN5180ISO15693::writeMultipleBlocks(uint8_t *uid, uint8_t firstBlock, uint16_t numBlocks, uint8_t *blockData, uint8_t blockSize) {
+  return writeBlocks(uid, firstBlock, numBlocks, blockData, blockSize, false);
+}
+
+ISO15693ErrorCode PN5180ISO15693::writeMultipleBlocksExtended(uint8_t *uid, uint16_t firstBlock, uint16_t numBlocks, uint8_t *blockData, uint8_t blockSize) {
+  return writeBlocks(uid, firstBlock, numBlocks, blockData, blockSize, true);
+}
+
+/*
+ * Addressed block command in commandBuffer: flags, command, UID, block
+ * number, and numBlocks-1 if numBlocks is not 0. Extended commands take
+ * block number and count with 16 bit, LSB first.
+ *
+ * return value: length of the command so far
+ */
+uint8_t PN5180ISO15693::buildBlockCommand(uint8_t command, uint8_t *uid, uint16_t blockNo, uint16_t numBlocks, bool extended) {
+  uint8_t pos = 0;
+  commandBuffer[pos++] = 0x22;  // high data rate, no options, addressed by UID
+  commandBuffer[pos++] = command;
+  for (int i=0; i<8; i++) {
+    commandBuffer[pos++] = uid[i];  // UID has LSB first!
+  }
+  commandBuffer[pos++] = blockNo & 0xFF;
+  if (extended) commandBuffer[pos++] = blockNo >> 8;
+  if (0 != numBlocks) {
+    commandBuffer[pos++] = (numBlocks - 1) & 0xFF;
+    if (extended) commandBuffer[pos++] = (numBlocks - 1) >> 8;
+  }
+  return pos;
+}
+
+/*
+ * Read the blocks back with Read Multiple Blocks and compare them to data,
+ * right in the RX buffer of the PN5180, as many blocks per command as fit.
+ */
+ISO15693ErrorCode PN5180ISO15693::verifyBlocks(uint8_t *uid, uint16_t firstBlock, uint16_t numBlocks, uint8_t *data, uint8_t blockSize, bool extended) {
+  uint16_t maxBlocks = (508 - 1) / blockSize;
+
+  for (uint16_t done=0; done<numBlocks; ) {
+    uint16_t n = numBlocks - done;
+    if (n > maxBlocks) n = maxBlocks;
+
+    uint8_t pos = buildBlockCommand(extended ? 0x33 : 0x23, uid, firstBlock + done, n, extended);
+    uint8_t *resultPtr;
+    uint16_t resultLen;
+    ISO15693ErrorCode rc = issueISO15693Command(commandBuffer, pos, &resultPtr, &resultLen);
+    if (ISO15693_EC_OK != rc) {
+      return rc;
+    }
+    if (resultLen != 1 + n * blockSize) {
+      PN5180DEBUG(F("*** ERROR: wrong block data length!\n"));
+      return ISO15693_EC_UNKNOWN_ERROR;
+    }
+    if (0 != memcmp(&resultPtr[1], data + done * blockSize, n * blockSize)) {
+      PN5180DEBUG(F("Verify failed\n"));
+      return ISO15693_EC_BLOCK_NOT_PROGRAMMED;
+    }
+    done += n;
+  }
+  return ISO15693_EC_OK;
+}
+
+/*
+ * Write an image of numBlocks blocks starting at firstBlock. Write Multiple
+ * Blocks is used where the tag supports it, otherwise the blocks are written
+ * one by one. With verify set, the written range is read back in as few
+ * Read Multiple Blocks commands as possible afterwards, a difference is
+ * reported as ISO15693_EC_BLOCK_NOT_PROGRAMMED.
+ */
+ISO15693ErrorCode PN5180ISO15693::writeMemory(uint8_t *uid, uint16_t firstBlock, uint16_t numBlocks, uint8_t *data, bool verify) {
+  uint8_t blockSize = 0;
+  uint16_t totalBlocks = 0;
+  ISO15693ErrorCode rc = getMemorySize(uid, &blockSize, &totalBlocks);
   if (ISO15693_EC_OK != rc) {
-    free(writeCmd);
     return rc;
   }
+  if ((uint32_t)firstBlock + numBlocks > totalBlocks) {
+    return ISO15693_EC_BLOCK_NOT_AVAILABLE;
+  }
+  bool extended = (totalBlocks > 256);
+
+  rc = writeBlocks(uid, firstBlock, numBlocks, data, blockSize, extended);
+  if ((ISO15693_EC_NOT_SUPPORTED == rc) || (ISO15693_EC_OPTION_NOT_SUPPORTED == rc)) {
+    PN5180DEBUG(F("No Write Multiple Blocks, writing single blocks\n"));
+    rc = ISO15693_EC_OK;
+    for (uint16_t i=0; (i<numBlocks) && (ISO15693_EC_OK == rc); i++) {
+      if (extended) {
+        rc = writeSingleBlockExtended(uid, firstBlock + i, data + i * blockSize, blockSize);
+      }
+      else {
+        rc = writeSingleBlock(uid, firstBlock + i, data + i * blockSize, blockSize);
+      }
+    }
+  }
+  if ((ISO15693_EC_OK != rc) || !verify) {
+    return rc;
+  }
+  return verifyBlocks(uid, firstBlock, numBlocks, data, blockSize, extended);
+}
+
+/*
+ * Mark the blocks of a window that differ from image in changed (one bit
+ * per block). The window is read with one Read Multiple Blocks command and
+ * compared in the RX buffer, or block by block if the tag lacks it.
+ */
+ISO15693ErrorCode PN5180ISO15693::compareBlocks(uint8_t *uid, uint16_t firstBlock, uint16_t numBlocks, uint8_t *image, uint8_t blockSize,
+                                                bool extended, bool *readMultiple, uint8_t *changed) {
+  memset(changed, 0, (numBlocks + 7) / 8);
+
+  if (*readMultiple) {
+    uint8_t pos = buildBlockCommand(extended ? 0x33 : 0x23, uid, firstBlock, numBlocks, extended);
+    uint8_t *resultPtr;
+    uint16_t resultLen;
+    ISO15693ErrorCode rc = issueISO15693Command(commandBuffer, pos, &resultPtr, &resultLen);
+    if ((ISO15693_EC_OK == rc) && (resultLen != 1 + numBlocks * blockSize)) {
+      PN5180DEBUG(F("*** ERROR: wrong block data length!\n"));
+      return ISO15693_EC_UNKNOWN_ERROR;
+    }
+    if (ISO15693_EC_OK == rc) {
+      for (uint16_t i=0; i<numBlocks; i++) {
+        if (0 != memcmp(&resultPtr[1 + i * blockSize], image + i * blockSize, blockSize)) {
+          changed[i / 8] |= (1 << (i % 8));
+        }
+      }
+      return ISO15693_EC_OK;
+    }
+    if ((ISO15693_EC_NOT_SUPPORTED != rc) && (ISO15693_EC_OPTION_NOT_SUPPORTED != rc)) {
+      return rc;
+    }
+    *readMultiple = false;
+  }
+
+  uint8_t block[32];
+  for (uint16_t i=0; i<numBlocks; i++) {
+    ISO15693ErrorCode rc = extended ?
+      readSingleBlockExtended(uid, firstBlock + i, block, blockSize) :
+      readSingleBlock(uid, firstBlock + i, block, blockSize);
+    if (ISO15693_EC_OK != rc) {
+      return rc;
+    }
+    if (0 != memcmp(block, image + i * blockSize, blockSize)) {
+      changed[i / 8] |= (1 << (i % 8));
+    }
+  }
+  return ISO15693_EC_OK;
+}
+
+/*
+ * Bring numBlocks blocks starting at firstBlock to the content of image,
+ * writing only the blocks that differ. The current content is read in
+ * windows as large as the RX buffer allows, adjacent changed blocks are
+ * written together with Write Multiple Blocks if the tag supports it.
+ * An update of a mostly unchanged image costs a read pass plus a few writes.
+ *
+ * blocksWritten (optional, may be NULL) receives the number of blocks written.
+ */
+ISO15693ErrorCode PN5180ISO15693::syncMemory(uint8_t *uid, uint16_t firstBlock, uint16_t numBlocks, uint8_t *image, uint16_t *blocksWritten) {
+  uint16_t written = 0;
+  if (NULL != blocksWritten) *blocksWritten = 0;
+
+  uint8_t blockSize = 0;
+  uint16_t totalBlocks = 0;
+  ISO15693ErrorCode rc = getMemorySize(uid, &blockSize, &totalBlocks);
+  if (ISO15693_EC_OK != rc) {
+    return rc;
+  }
+  if ((blockSize > 32) || ((uint32_t)firstBlock + numBlocks > totalBlocks)) {
+    return ISO15693_EC_BLOCK_NOT_AVAILABLE;
+  }
+  bool extended = (totalBlocks > 256);
+  bool readMultiple = true, writeMultiple = true;
+  uint16_t maxBlocks = (508 - 1) / blockSize;
+
+  for (uint16_t window=0; window<numBlocks; ) {
+    uint16_t n = numBlocks - window;
+    if (n > maxBlocks) n = maxBlocks;
+
+    uint8_t changed[(507 + 7) / 8];
+    rc = compareBlocks(uid, firstBlock + window, n, image + window * blockSize, blockSize, extended, &readMultiple, changed);
+    if (ISO15693_EC_OK != rc) {
+      return rc;
+    }
+
+    for (uint16_t i=0; i<n; ) {
+      if (0 == (changed[i / 8] & (1 << (i % 8)))) {
+        i++;
+        continue;
+      }
+      uint16_t run = 1;
+      while ((i + run < n) && (changed[(i + run) / 8] & (1 << ((i + run) % 8)))) {
+        run++;
+      }
+
+      uint16_t blockNo = firstBlock + window + i;
+      uint8_t *data = image + (window + i) * blockSize;
+      rc = ISO15693_EC_NOT_SUPPORTED;
+      if (writeMultiple && (run > 1)) {
+        rc = writeBlocks(uid, blockNo, run, data, blockSize, extended);
+        if ((ISO15693_EC_NOT_SUPPORTED == rc) || (ISO15693_EC_OPTION_NOT_SUPPORTED == rc)) {
+          writeMultiple = false;
+        }
+      }
+      if ((ISO15693_EC_NOT_SUPPORTED == rc) || (ISO15693_EC_OPTION_NOT_SUPPORTED == rc)) {
+        rc = ISO15693_EC_OK;
+        for (uint16_t j=0; (j<run) && (ISO15693_EC_OK == rc); j++) {
+          rc = extended ?
+            writeSingleBlockExtended(uid, blockNo + j, data + j * blockSize, blockSize) :
+            writeSingleBlock(uid, blockNo + j, data + j * blockSize, blockSize);
+        }
+      }
+      if (ISO15693_EC_OK != rc) {
+        return rc;
+      }
+      written += run;
+      if (NULL != blocksWritten) *blocksWritten = written;
+      i += run;
+    }
+    window += n;
+  }
+
+  PN5180DEBUG(F("Blocks written: "));
+  PN5180DEBUG(written);
+  PN5180DEBUG("\n");
 
-  free(writeCmd);
+  return ISO15693_EC_OK;
+}
+
+/*
+ * Some tags (e.g. TI Tag-it HF-I) only accept write and lock commands with
+ * the option flag set. They don't answer after programming then, but wait
+ * for an EOF from the reader, see issueWriteCommand().
+ */
+void PN5180ISO15693::setWriteOptionFlag(bool enabled) {
+  writeOptionFlag = enabled;
+}
+
+/*
+ * Extended read single block, code=30, and Extended write single block, code=31
+ *
+ * As Read/Write single block, with a 16 bit block number (LSB first).
+ */
+ISO15693ErrorCode PN5180ISO15693::readSingleBlockExtended(uint8_t *uid, uint16_t blockNo, uint8_t *blockData, uint8_t blockSize) {
+  //                            flags, cmd, uid,             blockNo
+  uint8_t readSingleBlock[] = { 0x22, 0x30, 1,2,3,4,5,6,7,8, (uint8_t)(blockNo & 0xFF), (uint8_t)(blockNo >> 8) };
+  for (int i=0; i<8; i++) {
+    readSingleBlock[2+i] = uid[i];
+  }
+
+  PN5180DEBUG(F("Extended Read Single Block #"));
+  PN5180DEBUG(blockNo);
+  PN5180DEBUG("\n");
+
+  uint8_t *resultPtr;
+  ISO15693ErrorCode rc = issueISO15693Command(readSingleBlock, sizeof(readSingleBlock), &resultPtr);
+  if (ISO15693_EC_OK != rc) {
+    return rc;
+  }
+  memcpy(blockData, &resultPtr[1], blockSize);
+  return ISO15693_EC_OK;
+}
+
+ISO15693ErrorCode PN5180ISO15693::writeSingleBlockExtended(uint8_t *uid, uint16_t blockNo, uint8_t *blockData, uint8_t blockSize) {
+  if (blockSize > 32) {
+    return ISO15693_EC_OPTION_NOT_SUPPORTED;
+  }
+  uint8_t pos = buildBlockCommand(0x31, uid, blockNo, 0, true);
+  memcpy(&commandBuffer[pos], blockData, blockSize);
+  pos += blockSize;
+
+  PN5180DEBUG(F("Extended Write Single Block #"));
+  PN5180DEBUG(blockNo);
+  PN5180DEBUG("\n");
+
+  uint8_t *resultPtr;
+  return issueWriteCommand(pos, &resultPtr);
+}
+
+/*
+ * Read numBlocks blocks starting at firstBlock into buffer, which must hold
+ * numBlocks times the block size reported by getMemorySize(). Read Multiple
+ * Blocks is used where the tag supports it, the whole memory of a tag
+ * usually fits into a few commands. Tags without it are read block by block.
+ * Tags with more than 256 blocks are read with the extended commands.
+ */
+ISO15693ErrorCode PN5180ISO15693::readMemory(uint8_t *uid, uint16_t firstBlock, uint16_t numBlocks, uint8_t *buffer) {
+  uint8_t blockSize = 0;
+  uint16_t totalBlocks = 0;
+  ISO15693ErrorCode rc = getMemorySize(uid, &blockSize, &totalBlocks);
+  if (ISO15693_EC_OK != rc) {
+    return rc;
+  }
+  if ((uint32_t)firstBlock + numBlocks > totalBlocks) {
+    return ISO15693_EC_BLOCK_NOT_AVAILABLE;
+  }
+  bool extended = (totalBlocks > 256);
+
+  rc = readBlocks(uid, firstBlock, numBlocks, buffer, blockSize, extended);
+  if ((ISO15693_EC_NOT_SUPPORTED != rc) && (ISO15693_EC_OPTION_NOT_SUPPORTED != rc)) {
+    return rc;
+  }
+
+  PN5180DEBUG(F("No Read Multiple Blocks, reading single blocks\n"));
+  for (uint16_t i=0; i<numBlocks; i++) {
+    if (extended) {
+      rc = readSingleBlockExtended(uid, firstBlock + i, buffer + i * blockSize, blockSize);
+    }
+    else {
+      rc = readSingleBlock(uid, firstBlock + i, buffer + i * blockSize, blockSize);
+    }
+    if (ISO15693_EC_OK != rc) {
+      return rc;
+    }
+  }
   return ISO15693_EC_OK;
 }
 
@@ -375,6 +1171,79 @@ ISO15693ErrorCode PN5180ISO15693::getSystemInfo(uint8_t *uid, uint8_t *blockSize
   return ISO15693_EC_OK;
 }
 
+/*
+ * Extended get system information, code=3B
+ *
+ * Request format: SOF, Req.Flags, ExtGetSysInfo, InfoRequest, UID (opt.), CRC16, EOF
+ * Response format:
+ *  when ERROR flag is NOT set:
+ *    SOF, Flags, InfoFlags, UID, DSFID (opt.), AFI (opt.), Memory size (opt.), ..., CRC16, EOF
+ *
+ *    Memory size: NumBlocks-1 (16 bit, LSB first), BlockSize-1 (5 bit)
+ *
+ * Only the memory size is requested.
+ */
+ISO15693ErrorCode PN5180ISO15693::getExtendedSystemInfo(uint8_t *uid, uint8_t *blockSize, uint16_t *numBlocks) {
+  //                       flags, cmd, info request, uid
+  uint8_t extSysInfo[] = { 0x22, 0x3b, 0x04, 1,2,3,4,5,6,7,8 };  // UID has LSB first!
+  for (int i=0; i<8; i++) {
+    extSysInfo[3+i] = uid[i];
+  }
+
+  PN5180DEBUG(F("Get Extended System Information\n"));
+
+  uint8_t *readBuffer;
+  ISO15693ErrorCode rc = issueISO15693Command(extSysInfo, sizeof(extSysInfo), &readBuffer);
+  if (ISO15693_EC_OK != rc) {
+    return rc;
+  }
+
+  uint8_t infoFlags = readBuffer[1];
+  uint8_t *p = &readBuffer[10];
+  if (infoFlags & 0x01) p++;  // DSFID
+  if (infoFlags & 0x02) p++;  // AFI
+  if (0 == (infoFlags & 0x04)) {
+    return ISO15693_EC_OPTION_NOT_SUPPORTED;
+  }
+  *numBlocks = (p[0] | (p[1] << 8)) + 1;
+  *blockSize = (p[2] & 0x1f) + 1;
+
+  PN5180DEBUG(F("BlockSize="));
+  PN5180DEBUG(*blockSize);
+  PN5180DEBUG(F(" NumBlocks="));
+  PN5180DEBUG(*numBlocks);
+  PN5180DEBUG("\n");
+
+  return ISO15693_EC_OK;
+}
+
+/*
+ * Block size and number of blocks of a tag. Get System Information answers
+ * for most tags, its 8 bit block count can't describe tags with more than
+ * 256 blocks, these are asked with Extended Get System Information. Use
+ * readMultipleBlocksExtended() and friends for tags with numBlocks > 256.
+ */
+ISO15693ErrorCode PN5180ISO15693::getMemorySize(uint8_t *uid, uint8_t *blockSize, uint16_t *numBlocks) {
+  uint8_t size = 0, blocks = 0;
+  ISO15693ErrorCode rc = getSystemInfo(uid, &size, &blocks);
+  if ((ISO15693_EC_OK == rc) && (0 != size) && (0 != blocks)) {
+    *blockSize = size;
+    *numBlocks = blocks;
+    return ISO15693_EC_OK;
+  }
+  if ((ISO15693_EC_OK != rc) && (ISO15693_EC_NOT_SUPPORTED != rc) && (ISO15693_EC_OPTION_NOT_SUPPORTED != rc)) {
+    return rc;
+  }
+  // no memory size or 256 blocks (count wrapped to 0): maybe more
+  rc = getExtendedSystemInfo(uid, blockSize, numBlocks);
+  if ((ISO15693_EC_OK != rc) && (0 != size)) {
+    *blockSize = size;
+    *numBlocks = 256;
+    return ISO15693_EC_OK;
+  }
+  return rc;
+}
+
 
 // ICODE SLIX specific commands
 
@@ -484,6 +1353,220 @@ ISO15693ErrorCode PN5180ISO15693::newpasswordICODESLIX2(uint8_t *newpassword, ui
 
 }
 
+/*
+ * Addressed ICODE SLIX2 commands. The tag keeps its random number until the
+ * next GET RANDOM NUMBER or until it loses power, so one random per tag is
+ * fetched and reused for all password commands sent to that tag. Switching
+ * the field with setupRF() or startSession() forgets the randoms, call
+ * clearRandomCache() after switching it any other way.
+ */
+ISO15693ErrorCode PN5180ISO15693::getRandomNumber(uint8_t *uid, uint8_t *randomData) {
+  uint8_t getrandom[] = { 0x22, 0xB2, 0x04, uid[0], uid[1], uid[2], uid[3], uid[4], uid[5], uid[6], uid[7] };
+  uint8_t *readBuffer;
+  ISO15693ErrorCode rc = issueISO15693Command(getrandom, sizeof(getrandom), &readBuffer);
+  if (rc == ISO15693_EC_OK) {
+    randomData[0] = readBuffer[1];
+    randomData[1] = readBuffer[2];
+  }
+  return rc;
+}
+
+ISO15693ErrorCode PN5180ISO15693::setPassword(uint8_t *uid, uint8_t passwordId, uint8_t *password, uint8_t *random) {
+  uint8_t setPassword[] = { 0x22, 0xB3, 0x04, uid[0], uid[1], uid[2], uid[3], uid[4], uid[5], uid[6], uid[7], passwordId,
+                            (uint8_t)(password[0] ^ random[0]), (uint8_t)(password[1] ^ random[1]),
+                            (uint8_t)(password[2] ^ random[0]), (uint8_t)(password[3] ^ random[1]) };
+  uint8_t *readBuffer;
+  return issueISO15693Command(setPassword, sizeof(setPassword), &readBuffer);
+}
+
+ISO15693ErrorCode PN5180ISO15693::enablePrivacy(uint8_t *uid, uint8_t *password, uint8_t *random) {
+  uint8_t setPrivacy[] = { 0x22, 0xBA, 0x04, uid[0], uid[1], uid[2], uid[3], uid[4], uid[5], uid[6], uid[7],
+                           (uint8_t)(password[0] ^ random[0]), (uint8_t)(password[1] ^ random[1]),
+                           (uint8_t)(password[2] ^ random[0]), (uint8_t)(password[3] ^ random[1]) };
+  uint8_t *readBuffer;
+  return issueISO15693Command(setPrivacy, sizeof(setPrivacy), &readBuffer);
+}
+
+void PN5180ISO15693::clearRandomCache() {
+  for (int i=0; i<ICODE_SLIX2_RANDOM_CACHE_SIZE; i++) {
+    randomCache[i].valid = false;
+  }
+  randomCacheNext = 0;
+}
+
+/*
+ * Random number of the tag from the cache, fetched from the tag if unknown
+ * or if refresh is set. The oldest entry makes room for new tags.
+ */
+ISO15693ErrorCode PN5180ISO15693::cachedRandom(uint8_t *uid, uint8_t *random, bool refresh) {
+  int entry = -1;
+  for (int i=0; i<ICODE_SLIX2_RANDOM_CACHE_SIZE; i++) {
+    if (randomCache[i].valid && (0 == memcmp(randomCache[i].uid, uid, 8))) {
+      entry = i;
+      break;
+    }
+  }
+  if ((entry >= 0) && !refresh) {
+    random[0] = randomCache[entry].random[0];
+    random[1] = randomCache[entry].random[1];
+    return ISO15693_EC_OK;
+  }
+
+  ISO15693ErrorCode rc = getRandomNumber(uid, random);
+  if (ISO15693_EC_OK != rc) {
+    if (entry >= 0) randomCache[entry].valid = false;
+    return rc;
+  }
+  if (entry < 0) {
+    entry = randomCacheNext;
+    randomCacheNext = (randomCacheNext + 1) % ICODE_SLIX2_RANDOM_CACHE_SIZE;
+  }
+  memcpy(randomCache[entry].uid, uid, 8);
+  randomCache[entry].random[0] = random[0];
+  randomCache[entry].random[1] = random[1];
+  randomCache[entry].valid = true;
+  return ISO15693_EC_OK;
+}
+
+/*
+ * Send the privacy password to the tag, with the cached random first. A
+ * rejected password may stem from a stale random (the tag lost power in
+ * between), it is tried once more with a fresh one.
+ */
+ISO15693ErrorCode PN5180ISO15693::sendPrivacyPassword(uint8_t *uid, uint8_t *password, bool privacy) {
+  uint8_t random[2];
+  ISO15693ErrorCode rc = EC_NO_CARD;
+  for (int attempt=0; attempt<2; attempt++) {
+    rc = cachedRandom(uid, random, attempt > 0);
+    if (ISO15693_EC_OK != rc) {
+      return rc;
+    }
+    rc = privacy ? enablePrivacy(uid, password, random) : setPassword(uid, 0x04, password, random);
+    if ((ISO15693_EC_OK == rc) || (EC_NO_CARD == rc)) {
+      break;
+    }
+  }
+  return rc;
+}
+
+// unlock the ICODE SLIX2 tag with the given UID
+ISO15693ErrorCode PN5180ISO15693::unlockICODESLIX2(uint8_t *uid, uint8_t *password) {
+  return sendPrivacyPassword(uid, password, false);
+}
+
+// lock the ICODE SLIX2 tag with the given UID (set to privacy mode)
+ISO15693ErrorCode PN5180ISO15693::lockICODESLIX2(uint8_t *uid, uint8_t *password) {
+  return sendPrivacyPassword(uid, password, true);
+}
+
+// set a new privacy password for the ICODE SLIX2 tag with the given UID
+ISO15693ErrorCode PN5180ISO15693::changePasswordICODESLIX2(uint8_t *uid, uint8_t *oldpassword, uint8_t *newpassword) {
+  ISO15693ErrorCode rc = sendPrivacyPassword(uid, oldpassword, false);
+  if (rc != ISO15693_EC_OK) {
+    return rc;
+  }
+  return writePassword(newpassword, uid);
+}
+
+/*
+ * Run one operation on all tags in uids (8 bytes each), e.g. the result of
+ * getInventoryMultiple(). newPassword is only used by ICODE_SLIX2_NEW_PASSWORD.
+ * results (optional, may be NULL) receives the outcome for each tag.
+ *
+ * return value: number of tags the operation succeeded on
+ */
+uint8_t PN5180ISO15693::batchICODESLIX2(ICODESLIX2Operation operation, uint8_t *uids, uint8_t numTags,
+                                        uint8_t *password, uint8_t *newPassword, ISO15693ErrorCode *results) {
+  uint8_t succeeded = 0;
+  for (int i=0; i<numTags; i++) {
+    uint8_t *uid = &uids[8*i];
+    ISO15693ErrorCode rc;
+    switch (operation) {
+      case ICODE_SLIX2_UNLOCK:       rc = unlockICODESLIX2(uid, password); break;
+      case ICODE_SLIX2_LOCK:         rc = lockICODESLIX2(uid, password); break;
+      case ICODE_SLIX2_NEW_PASSWORD: rc = changePasswordICODESLIX2(uid, password, newPassword); break;
+      default:                       rc = ISO15693_EC_NOT_SUPPORTED; break;
+    }
+    if (NULL != results) {
+      results[i] = rc;
+    }
+    if (ISO15693_EC_OK == rc) {
+      succeeded++;
+    }
+  }
+  return succeeded;
+}
+
+
+/*
+ * Time from the end of sendData() to the start of the answer, in ms:
+ * the command is still on air (1 out of 4 coding, about 0.3ms per byte),
+ * then the VICC answers within t1 (about 0.3ms), or after programming its
+ * memory for write and lock commands.
+ */
+uint16_t PN5180ISO15693::responseTimeout(uint8_t *cmd, uint8_t cmdLen) {
+  return 1 + (cmdLen * 3) / 10 + ISO15693_RESPONSE_TIMEOUT + programmingTime(cmd);
+}
+
+/*
+ * Time the VICC needs to program its memory for a write or lock command,
+ * 0 for any other command.
+ */
+uint16_t PN5180ISO15693::programmingTime(uint8_t *cmd) {
+  uint8_t uidLen = (cmd[0] & 0x20) ? 8 : 0;  // addressed flag
+
+  switch (cmd[1]) {
+    case 0x24: // write multiple blocks, numBlocks-1 follows the block number
+      return ISO15693_WRITE_TIMEOUT * (cmd[2 + uidLen + 1] + 1);
+    case 0x34: // extended write multiple blocks, 16 bit block number
+      return ISO15693_WRITE_TIMEOUT * (cmd[2 + uidLen + 2] + 1);
+    case 0x21: // write single block
+    case 0x22: // lock block
+    case 0x27: // write AFI
+    case 0x28: // lock AFI
+    case 0x29: // write DSFID
+    case 0x2A: // lock DSFID
+    case 0x31: // extended write single block
+    case 0x32: // extended lock block
+    case 0xB4: // NXP write password
+    case 0xB5: // NXP lock password
+    case 0xB6: // NXP protect page
+    case 0xB7: // NXP lock page protection condition
+      return ISO15693_WRITE_TIMEOUT;
+  }
+  return 0;
+}
+
+/*
+ * Send the write or lock command in commandBuffer. With the option flag
+ * set, the VICC programs its memory after the request and answers only
+ * after an EOF sent by the reader, which must not come before the
+ * programming time has passed.
+ */
+ISO15693ErrorCode PN5180ISO15693::issueWriteCommand(uint8_t cmdLen, uint8_t **resultPtr) {
+  if (!writeOptionFlag) {
+    return issueISO15693Command(commandBuffer, cmdLen, resultPtr);
+  }
+  commandBuffer[0] |= 0x40;  // option flag
+
+  clearIRQStatus(RX_SOF_DET_IRQ_STAT | IDLE_IRQ_STAT | TX_IRQ_STAT | RX_IRQ_STAT);
+  sendData(commandBuffer, cmdLen);
+  uint32_t status = waitForIRQ(TX_IRQ_STAT, 1 + (cmdLen * 3) / 10);
+  if (0 == (status & TX_IRQ_STAT)) {
+    return ISO15693_EC_UNKNOWN_ERROR;
+  }
+  delay(programmingTime(commandBuffer));
+
+  uint32_t txConfig;
+  readRegister(TX_CONFIG, &txConfig);
+  writeRegisterWithAndMask(TX_CONFIG, 0xFFFFFB3F);  // no SOF, no data: send EOF only
+  clearIRQStatus(RX_SOF_DET_IRQ_STAT | IDLE_IRQ_STAT | TX_IRQ_STAT | RX_IRQ_STAT);
+  sendData(commandBuffer, 0);
+  writeRegister(TX_CONFIG, txConfig);
+
+  return receiveISO15693Response(1 + ISO15693_RESPONSE_TIMEOUT, resultPtr);
+}
+
 
 /*
  * ISO 15693 - Protocol
@@ -539,22 +1622,36 @@ ISO15693ErrorCode PN5180ISO15693::newpasswordICODESLIX2(uint8_t *newpassword, ui
  *   -1 = No card detected
  *   >0 = Error code
  */
-ISO15693ErrorCode PN5180ISO15693::issueISO15693Command(uint8_t *cmd, uint8_t cmdLen, uint8_t **resultPtr) {
+ISO15693ErrorCode PN5180ISO15693::issueISO15693Command(uint8_t *cmd, uint8_t cmdLen, uint8_t **resultPtr, uint16_t *resultLen) {
 #ifdef DEBUG
   PN5180DEBUG(F("Issue Command 0x"));
   PN5180DEBUG(formatHex(cmd[1]));
   PN5180DEBUG("...\n");
 #endif
 
+  clearIRQStatus(RX_SOF_DET_IRQ_STAT | IDLE_IRQ_STAT | TX_IRQ_STAT | RX_IRQ_STAT);
   sendData(cmd, cmdLen);
-  delay(10);
-  uint32_t status = getIRQStatus();
-  if (0 == (status & RX_SOF_DET_IRQ_STAT)) {
+
+  return receiveISO15693Response(responseTimeout(cmd, cmdLen), resultPtr, resultLen);
+}
+
+/*
+ * Wait for the answer to start within timeoutMs, then for its end, and
+ * check the response flags. resultLen (optional, may be NULL) receives the
+ * number of bytes in the answer, flags included.
+ */
+ISO15693ErrorCode PN5180ISO15693::receiveISO15693Response(uint16_t timeoutMs, uint8_t **resultPtr, uint16_t *resultLen) {
+  uint32_t status = waitForIRQ(RX_SOF_DET_IRQ_STAT | RX_IRQ_STAT, timeoutMs);
+  if (0 == (status & (RX_SOF_DET_IRQ_STAT | RX_IRQ_STAT))) {
     return EC_NO_CARD;
   }
-  while (0 == (status & RX_IRQ_STAT)) {
-    delay(10);
-    status = getIRQStatus();
+  // once it started, the frame ends after its air time at the latest
+  if (0 == (status & RX_IRQ_STAT)) {
+    status = waitForIRQ(RX_IRQ_STAT, ISO15693_RX_TIMEOUT);
+    if (0 == (status & RX_IRQ_STAT)) {
+      PN5180DEBUG(F("*** ERROR: reception not completed!\n"));
+      return ISO15693_EC_UNKNOWN_ERROR;
+    }
   }
 
   uint32_t rxStatus;
@@ -569,11 +1666,19 @@ ISO15693ErrorCode PN5180ISO15693::issueISO15693Command(uint8_t *cmd, uint8_t cmd
   PN5180DEBUG(len);
   PN5180DEBUG("\n");
 
+  if (rxStatus & (RX_DATA_INTEGRITY_ERROR | RX_PROTOCOL_ERROR | RX_COLLISION_DETECTED)) {
+    PN5180DEBUG(F("*** ERROR: corrupted response!\n"));
+    return ISO15693_EC_UNKNOWN_ERROR;
+  }
+
  *resultPtr = readData(len);
   if (0L == *resultPtr) {
     PN5180DEBUG(F("*** ERROR in readData!\n"));
     return ISO15693_EC_UNKNOWN_ERROR;
   }
+  if (NULL != resultLen) {
+    *resultLen = len;
+  }
 
 #ifdef DEBUG
   Serial.print("Read=");
@@ -584,12 +1689,6 @@ ISO15693ErrorCode PN5180ISO15693::issueISO15693Command(uint8_t *cmd, uint8_t cmd
   Serial.println();
 #endif
 
-  uint32_t irqStatus = getIRQStatus();
-  if (0 == (RX_SOF_DET_IRQ_STAT & irqStatus)) { // no card detected
-     clearIRQStatus(TX_IRQ_STAT | IDLE_IRQ_STAT);
-     return EC_NO_CARD;
-  }
-
   uint8_t responseFlags = (*resultPtr)[0];
   if (responseFlags & (1<<0)) { // error flag
     uint8_t errorCode = (*resultPtr)[1];
@@ -616,9 +1715,29 @@ ISO15693ErrorCode PN5180ISO15693::issueISO15693Command(uint8_t *cmd, uint8_t cmd
   return ISO15693_EC_OK;
 }
 
-bool PN5180ISO15693::setupRF() {
+/*
+ * Select the modulation of the reader and whether fast commands are used.
+ * Requests are always sent with the high data rate flag and a single
+ * subcarrier, the only answer format the PN5180 receives at 26kbit/s.
+ * Tags send 53kbit/s only in answer to fast commands, for which the 53kbit/s
+ * receiver is loaded while they run. The PN5180 can't receive the dual
+ * subcarrier answer, so there is no profile for it.
+ */
+bool PN5180ISO15693::setRFProfile(ISO15693RFProfile profile) {
+  rfProfile = profile;
+  return loadRFConfig(profileTxConf(), 0x8d);  // ISO15693 parameters, receive with 26kbit/s
+}
+
+/*
+ * TX configuration of the RF profile: 0D = ASK100, 0E = ASK10, both 26kbit/s
+ */
+uint8_t PN5180ISO15693::profileTxConf() {
+  return (rfProfile & ISO15693_PROFILE_ASK10) ? 0x0e : 0x0d;
+}
+
+bool PN5180ISO15693::setupRF(ISO15693RFProfile profile) {
   PN5180DEBUG(F("Loading RF-Configuration...\n"));
-  if (loadRFConfig(0x0d, 0x8d)) {  // ISO15693 parameters
+  if (setRFProfile(profile)) {
     PN5180DEBUG(F("done.\n"));
   }
   else return false;
@@ -628,6 +1747,7 @@ bool PN5180ISO15693::setupRF() {
     PN5180DEBUG(F("done.\n"));
   }
   else return false;
+  clearRandomCache();
 
   writeRegisterWithAndMask(SYSTEM_CONFIG, 0xfffffff8);  // Idle/StopCom Command
   writeRegisterWithOrMask(SYSTEM_CONFIG, 0x00000003);   // Transceive Command
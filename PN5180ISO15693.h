@@ -21,6 +21,31 @@
 
 #include "PN5180.h"
 
+// mask refinement stops here, 64 bit UID minus the 4 bits selected by the slot
+#define ISO15693_MAX_MASK_LEN 60
+
+// blocks per Write Multiple Blocks command, most tags accept at most 4
+#ifndef ISO15693_MAX_WRITE_BLOCKS
+#define ISO15693_MAX_WRITE_BLOCKS 4
+#endif
+
+// longest command built in the command buffer: addressed extended Write
+// Multiple Blocks with ISO15693_MAX_WRITE_BLOCKS blocks of 32 bytes
+#define ISO15693_COMMAND_BUFFER_SIZE (14 + ISO15693_MAX_WRITE_BLOCKS * 32)
+#if ISO15693_COMMAND_BUFFER_SIZE > 255
+#error "ISO15693_MAX_WRITE_BLOCKS too large"
+#endif
+
+// tags handled per inventorySession() round, later arrivals are found in the next round
+#ifndef ISO15693_SESSION_MAX_TAGS
+#define ISO15693_SESSION_MAX_TAGS 16
+#endif
+
+// tags whose ICODE SLIX2 random number is kept for password commands
+#ifndef ICODE_SLIX2_RANDOM_CACHE_SIZE
+#define ICODE_SLIX2_RANDOM_CACHE_SIZE 8
+#endif
+
 enum ISO15693ErrorCode {
   EC_NO_CARD = -1,
   ISO15693_EC_OK = 0,
@@ -36,20 +61,131 @@ enum ISO15693ErrorCode {
   ISO15693_EC_CUSTOM_CMD_ERROR = 0xA0
 };
 
+/*
+ * Parameters and results of a slotted inventory, passed down the mask
+ * recursion of inventoryRound().
+ */
+struct ISO15693InventoryScan {
+  uint8_t command;      // 01 = Inventory, A0 = Inventory Read, B0 = Fast Inventory Read
+  uint8_t afi;
+  uint8_t firstBlock;   // Inventory Read only
+  uint8_t numBlocks;
+  uint8_t *uids;
+  uint8_t *dsfids;      // Inventory only, may be NULL
+  uint8_t *blockData;   // Inventory Read only
+  uint16_t dataLen;     // bytes of block data per tag
+  uint8_t maxTags;
+  uint8_t *numTags;
+};
+
+/*
+ * Modulation used by the reader and the answer data rate of fast commands,
+ * ASK10 keeps more energy in the field and reaches further, ASK100 is more
+ * robust against noise at short range.
+ */
+enum ISO15693RFProfile {
+  ISO15693_PROFILE_ASK100 = 0x00,       // 100% ASK, 26kbit/s answers (default)
+  ISO15693_PROFILE_ASK10 = 0x01,        // 10% ASK, 26kbit/s answers
+  ISO15693_PROFILE_FAST = 0x02,         // flag: fast commands answer with 53kbit/s
+  ISO15693_PROFILE_ASK100_FAST = 0x02,
+  ISO15693_PROFILE_ASK10_FAST = 0x03
+};
+
+enum ICODESLIX2Operation {
+  ICODE_SLIX2_UNLOCK,
+  ICODE_SLIX2_LOCK,
+  ICODE_SLIX2_NEW_PASSWORD
+};
+
+struct ICODESLIX2Random {
+  uint8_t uid[8];
+  uint8_t random[2];
+  bool valid;
+};
+
+class PN5180ISO15693;
+
+/*
+ * Called by inventorySession() for each tag not processed before. The tag is
+ * in READY state and can be addressed by uid. Return true when done with the
+ * tag, it is sent to QUIET state then and ignores the following inventories.
+ * Return false to see it again in the next round.
+ */
+typedef bool (*ISO15693TagCallback)(PN5180ISO15693 *reader, uint8_t *uid, uint8_t dsfid, void *context);
+
+/*
+ * State of a tag population worked through with inventorySession(). Quiet
+ * tags only wake up on Reset to Ready or when they leave the field, so tags
+ * coming back are found again like new arrivals.
+ */
+struct ISO15693Session {
+  uint8_t uids[ISO15693_SESSION_MAX_TAGS][8];  // tags of the last round
+  uint8_t dsfids[ISO15693_SESSION_MAX_TAGS];
+  uint8_t numTags;                              // found in the last round
+  uint32_t processedTags;                       // quieted since startSession()
+  uint8_t afi;                                  // application family taking part, 0 = all
+};
+
 class PN5180ISO15693 : public PN5180 {
 
 public:
   PN5180ISO15693(uint8_t SSpin, uint8_t BUSYpin, uint8_t RSTpin);
   
 private:
-  ISO15693ErrorCode issueISO15693Command(uint8_t *cmd, uint8_t cmdLen, uint8_t **resultPtr);
+  uint8_t commandBuffer[ISO15693_COMMAND_BUFFER_SIZE];
+  bool writeOptionFlag = false;
+  ICODESLIX2Random randomCache[ICODE_SLIX2_RANDOM_CACHE_SIZE];
+  uint8_t randomCacheNext = 0;
+  ISO15693RFProfile rfProfile = ISO15693_PROFILE_ASK100;
+  uint8_t profileTxConf();
+  ISO15693ErrorCode cachedRandom(uint8_t *uid, uint8_t *random, bool refresh);
+  ISO15693ErrorCode sendPrivacyPassword(uint8_t *uid, uint8_t *password, bool privacy);
+  ISO15693ErrorCode issueISO15693Command(uint8_t *cmd, uint8_t cmdLen, uint8_t **resultPtr, uint16_t *resultLen = NULL);
+  ISO15693ErrorCode issueWriteCommand(uint8_t cmdLen, uint8_t **resultPtr);
+  ISO15693ErrorCode receiveISO15693Response(uint16_t timeoutMs, uint8_t **resultPtr, uint16_t *resultLen = NULL);
+  uint16_t responseTimeout(uint8_t *cmd, uint8_t cmdLen);
+  uint16_t programmingTime(uint8_t *cmd);
+  uint8_t buildBlockCommand(uint8_t command, uint8_t *uid, uint16_t blockNo, uint16_t numBlocks, bool extended);
+  ISO15693ErrorCode verifyBlocks(uint8_t *uid, uint16_t firstBlock, uint16_t numBlocks, uint8_t *data, uint8_t blockSize, bool extended);
+  ISO15693ErrorCode compareBlocks(uint8_t *uid, uint16_t firstBlock, uint16_t numBlocks, uint8_t *image, uint8_t blockSize,
+                                  bool extended, bool *readMultiple, uint8_t *changed);
+  bool inventoryRound(ISO15693InventoryScan *scan, uint8_t *mask, uint8_t maskLen);
+  void setSlotBits(uint8_t *uid, uint8_t maskLen, uint8_t slot);
+  ISO15693ErrorCode readBlocks(uint8_t *uid, uint16_t firstBlock, uint16_t numBlocks, uint8_t *blockData, uint8_t blockSize, bool extended);
+  ISO15693ErrorCode writeBlocks(uint8_t *uid, uint16_t firstBlock, uint16_t numBlocks, uint8_t *blockData, uint8_t blockSize, bool extended);
 public:
   ISO15693ErrorCode getInventory(uint8_t *uid);
+  ISO15693ErrorCode getInventoryMultiple(uint8_t *uids, uint8_t *dsfids, uint8_t maxTags, uint8_t *numTags);
+  ISO15693ErrorCode getInventoryMultiple(uint8_t *uids, uint8_t *dsfids, uint8_t maxTags, uint8_t *numTags,
+                                         uint8_t afi, const uint8_t *mask = NULL, uint8_t maskLen = 0);
+  ISO15693ErrorCode getInventoryRead(uint8_t *uids, uint8_t *blockData, uint8_t firstBlock, uint8_t numBlocks, uint8_t blockSize,
+                                     uint8_t maxTags, uint8_t *numTags, uint8_t afi = 0x00);
+
+  ISO15693ErrorCode stayQuiet(uint8_t *uid);
+  ISO15693ErrorCode selectTag(uint8_t *uid);
+  ISO15693ErrorCode resetToReady(uint8_t *uid);
+
+  bool startSession(ISO15693Session *session, uint8_t afi = 0x00);
+  uint8_t inventorySession(ISO15693Session *session, ISO15693TagCallback callback, void *context);
 
   ISO15693ErrorCode readSingleBlock(uint8_t *uid, uint8_t blockNo, uint8_t *blockData, uint8_t blockSize);
   ISO15693ErrorCode writeSingleBlock(uint8_t *uid, uint8_t blockNo, uint8_t *blockData, uint8_t blockSize);
+  ISO15693ErrorCode readMultipleBlocks(uint8_t *uid, uint8_t firstBlock, uint16_t numBlocks, uint8_t *blockData, uint8_t blockSize);
+  ISO15693ErrorCode writeMultipleBlocks(uint8_t *uid, uint8_t firstBlock, uint16_t numBlocks, uint8_t *blockData, uint8_t blockSize);
+  ISO15693ErrorCode readMemory(uint8_t *uid, uint16_t firstBlock, uint16_t numBlocks, uint8_t *buffer);
+  ISO15693ErrorCode writeMemory(uint8_t *uid, uint16_t firstBlock, uint16_t numBlocks, uint8_t *data, bool verify = true);
+  ISO15693ErrorCode syncMemory(uint8_t *uid, uint16_t firstBlock, uint16_t numBlocks, uint8_t *image, uint16_t *blocksWritten = NULL);
+  void setWriteOptionFlag(bool enabled);
+
+  // protocol extension, 16 bit block numbers for tags with more than 256 blocks
+  ISO15693ErrorCode readSingleBlockExtended(uint8_t *uid, uint16_t blockNo, uint8_t *blockData, uint8_t blockSize);
+  ISO15693ErrorCode writeSingleBlockExtended(uint8_t *uid, uint16_t blockNo, uint8_t *blockData, uint8_t blockSize);
+  ISO15693ErrorCode readMultipleBlocksExtended(uint8_t *uid, uint16_t firstBlock, uint16_t numBlocks, uint8_t *blockData, uint8_t blockSize);
+  ISO15693ErrorCode writeMultipleBlocksExtended(uint8_t *uid, uint16_t firstBlock, uint16_t numBlocks, uint8_t *blockData, uint8_t blockSize);
 
   ISO15693ErrorCode getSystemInfo(uint8_t *uid, uint8_t *blockSize, uint8_t *numBlocks);
+  ISO15693ErrorCode getExtendedSystemInfo(uint8_t *uid, uint8_t *blockSize, uint16_t *numBlocks);
+  ISO15693ErrorCode getMemorySize(uint8_t *uid, uint8_t *blockSize, uint16_t *numBlocks);
    
   // ICODE SLIX2 specific commands, see https://www.nxp.com/docs/en/data-sheet/SL2S2602.pdf
   ISO15693ErrorCode getRandomNumber(uint8_t *randomData);
@@ -59,11 +195,22 @@ public:
   ISO15693ErrorCode unlockICODESLIX2(uint8_t *password);
   ISO15693ErrorCode lockICODESLIX2(uint8_t *password);
   ISO15693ErrorCode newpasswordICODESLIX2(uint8_t *newpassword, uint8_t *oldpassword, uint8_t *uid);
+  // addressed variants, one random number per tag while the field is on
+  ISO15693ErrorCode getRandomNumber(uint8_t *uid, uint8_t *randomData);
+  ISO15693ErrorCode setPassword(uint8_t *uid, uint8_t passwordId, uint8_t *password, uint8_t *random);
+  ISO15693ErrorCode enablePrivacy(uint8_t *uid, uint8_t *password, uint8_t *random);
+  ISO15693ErrorCode unlockICODESLIX2(uint8_t *uid, uint8_t *password);
+  ISO15693ErrorCode lockICODESLIX2(uint8_t *uid, uint8_t *password);
+  ISO15693ErrorCode changePasswordICODESLIX2(uint8_t *uid, uint8_t *oldpassword, uint8_t *newpassword);
+  uint8_t batchICODESLIX2(ICODESLIX2Operation operation, uint8_t *uids, uint8_t numTags,
+                          uint8_t *password, uint8_t *newPassword = NULL, ISO15693ErrorCode *results = NULL);
+  void clearRandomCache();
   /*
    * Helper functions
    */
 public:   
-  bool setupRF();
+  bool setupRF(ISO15693RFProfile profile = ISO15693_PROFILE_ASK100);
+  bool setRFProfile(ISO15693RFProfile profile);
   const __FlashStringHelper *strerror(ISO15693ErrorCode errno);
     
 };
@@ -0,0 +1,716 @@
+// NAME: PN5180NDEF.cpp
+//
+// DESC: NFC Forum NDEF read and write for Type 2, Type 4 and Type 5 tags
+//       with a streaming record parser.
+//
+// Copyright (c) 2026 by HOCC2011. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+//#define DEBUG 1
+
+#include <Arduino.h>
+#include "PN5180NDEF.h"
+#include "Debug.h"
+
+// parser states
+#define NDEF_STATE_HEADER         0
+#define NDEF_STATE_TYPE_LENGTH    1
+#define NDEF_STATE_PAYLOAD_LENGTH 2
+#define NDEF_STATE_ID_LENGTH      3
+#define NDEF_STATE_TYPE           4
+#define NDEF_STATE_ID             5
+#define NDEF_STATE_PAYLOAD        6
+
+#define NDEF_FLAG_ME              0x40
+#define NDEF_FLAG_SR              0x10
+#define NDEF_FLAG_IL              0x08
+
+#define NDEF_TLV_NULL             0x00
+#define NDEF_TLV_MESSAGE          0x03
+#define NDEF_TLV_TERMINATOR       0xFE
+
+// result of findNdefTlv()
+#define NDEF_TLV_FOUND            0
+#define NDEF_TLV_NOT_FOUND        1
+#define NDEF_TLV_READ_ERROR       2
+
+// time a Type 4 tag needs to answer SELECT, READ BINARY and UPDATE BINARY
+#define NDEF_TYPE4_READ_DELAY     10
+
+NdefParser::NdefParser(NdefRecordCallback callback, void *context) {
+  this->callback = callback;
+  this->context = context;
+  record.index = 0;
+  state = NDEF_STATE_HEADER;
+  fieldPos = 0;
+  payloadPos = 0;
+  complete = false;
+  stopped = false;
+}
+
+void NdefParser::startFields() {
+  fieldPos = 0;
+  if (record.typeLength > 0) {
+    state = NDEF_STATE_TYPE;
+  }
+  else if (record.idLength > 0) {
+    state = NDEF_STATE_ID;
+  }
+  else {
+    beginPayload();
+  }
+}
+
+void NdefParser::beginPayload() {
+  payloadPos = 0;
+  if (record.payloadLength > 0) {
+    state = NDEF_STATE_PAYLOAD;
+    return;
+  }
+  if (!callback(&record, NULL, 0, 0, context)) {
+    stopped = true;
+    return;
+  }
+  endRecord();
+}
+
+void NdefParser::endRecord() {
+  if (record.flags & NDEF_FLAG_ME) {
+    complete = true;
+    return;
+  }
+  record.index++;
+  state = NDEF_STATE_HEADER;
+}
+
+/*
+ * Consume the next bytes of the NDEF message. The record header is collected
+ * byte by byte, the payload is handed to the callback straight from data
+ * without copying, so the message never has to fit into RAM.
+ *
+ * return value: false if the callback asked to stop
+ */
+bool NdefParser::feed(const uint8_t *data, uint16_t len) {
+  while ((len > 0) && !complete && !stopped) {
+    if (NDEF_STATE_PAYLOAD == state) {
+      uint32_t remaining = record.payloadLength - payloadPos;
+      uint16_t n = (remaining < len) ? remaining : len;
+      if (!callback(&record, data, n, payloadPos, context)) {
+        stopped = true;
+        break;
+      }
+      payloadPos += n;
+      data += n;
+      len -= n;
+      if (payloadPos == record.payloadLength) {
+        endRecord();
+      }
+      continue;
+    }
+
+    uint8_t b = *data++;
+    len--;
+    switch (state) {
+      case NDEF_STATE_HEADER:
+        record.flags = b;
+        record.tnf = b & 0x07;
+        record.idLength = 0;
+        record.payloadLength = 0;
+        fieldPos = 0;
+        state = NDEF_STATE_TYPE_LENGTH;
+        break;
+      case NDEF_STATE_TYPE_LENGTH:
+        record.typeLength = b;
+        state = NDEF_STATE_PAYLOAD_LENGTH;
+        break;
+      case NDEF_STATE_PAYLOAD_LENGTH:
+        // 1 byte for short records, else 4 bytes MSB first
+        record.payloadLength = (record.payloadLength << 8) | b;
+        if ((record.flags & NDEF_FLAG_SR) || (4 == ++fieldPos)) {
+          if (record.flags & NDEF_FLAG_IL) {
+            state = NDEF_STATE_ID_LENGTH;
+          }
+          else {
+            startFields();
+          }
+        }
+        break;
+      case NDEF_STATE_ID_LENGTH:
+        record.idLength = b;
+        startFields();
+        break;
+      case NDEF_STATE_TYPE:
+        if (fieldPos < NDEF_MAX_TYPE_LENGTH) {
+          record.type[fieldPos] = b;
+        }
+        if (++fieldPos == record.typeLength) {
+          fieldPos = 0;
+          if (record.idLength > 0) {
+            state = NDEF_STATE_ID;
+          }
+          else {
+            beginPayload();
+          }
+        }
+        break;
+      case NDEF_STATE_ID:
+        if (fieldPos < NDEF_MAX_ID_LENGTH) {
+          record.id[fieldPos] = b;
+        }
+        if (++fieldPos == record.idLength) {
+          beginPayload();
+        }
+        break;
+    }
+  }
+  return !stopped;
+}
+
+bool NdefParser::isComplete() {
+  return complete;
+}
+
+bool NdefParser::isStopped() {
+  return stopped;
+}
+
+PN5180NDEF::PN5180NDEF(PN5180ISO14443 &reader) {
+  iso14443 = &reader;
+  iso15693 = NULL;
+  tagType = 0;
+  uid = NULL;
+  unitSize = 1;
+  fastReadSupported = true;
+  extendedBlocks = false;
+  messageLength = 0;
+}
+
+PN5180NDEF::PN5180NDEF(PN5180ISO15693 &reader) {
+  iso14443 = NULL;
+  iso15693 = &reader;
+  tagType = 0;
+  uid = NULL;
+  unitSize = 1;
+  fastReadSupported = false;
+  extendedBlocks = false;
+  messageLength = 0;
+}
+
+/*
+ * Read len bytes from offset, both aligned to unitSize, using the largest
+ * read the tag type offers:
+ *   Type 2: FAST_READ over all pages, READ (4 pages) if the tag lacks FAST_READ
+ *   Type 4: READ BINARY in pieces of MLe
+ *   Type 5: READ MULTIPLE BLOCKS, READ SINGLE BLOCK if the tag lacks it
+ */
+bool PN5180NDEF::readUnits(uint32_t offset, uint8_t *buffer, uint16_t len) {
+  switch (tagType) {
+    case 2: {
+      uint8_t startPage = offset / 4;
+      if (fastReadSupported) {
+        if (len == iso14443->ntagFastRead(startPage, startPage + len/4 - 1, buffer)) {
+          return true;
+        }
+        // Ultralight and others NAK the FAST_READ, which sends the tag back to IDLE
+        PN5180DEBUG(F("NDEF: no FAST_READ, falling back to READ\n"));
+        fastReadSupported = false;
+        const ISO14443CardInfo *card = iso14443->getCardInfo();
+        uint8_t atqaSakUid[10];
+        if ((NULL == card) || (0 == iso14443->reactivateTypeA(card->uid, card->uidLength, atqaSakUid))) {
+          return false;
+        }
+      }
+      uint8_t block[16];
+      for (uint16_t pos=0; pos<len; pos+=16) {
+        if (!iso14443->mifareBlockRead(startPage + pos/4, block)) {
+          return false;
+        }
+        memcpy(buffer + pos, block, ((len - pos) < 16) ? (len - pos) : 16);
+      }
+      return true;
+    }
+    case 4: {
+      uint8_t response[NDEF_CHUNK_SIZE + 8];
+      for (uint16_t pos=0; pos<len; ) {
+        uint16_t n = len - pos;
+        if (n > maxReadLen) n = maxReadLen;
+        uint8_t apdu[] = { 0x00, 0xB0, (uint8_t)((offset + pos) >> 8), (uint8_t)(offset + pos), (uint8_t)n };
+        uint16_t responseLen;
+        if (!type4Apdu(apdu, sizeof(apdu), response, sizeof(response), &responseLen) || (responseLen != n)) {
+          return false;
+        }
+        memcpy(buffer + pos, response, n);
+        pos += n;
+      }
+      return true;
+    }
+    case 5:
+      if (fastReadSupported) {
+        ISO15693ErrorCode rc = extendedBlocks ?
+          iso15693->readMultipleBlocksExtended(uid, offset / unitSize, len / unitSize, buffer, unitSize) :
+          iso15693->readMultipleBlocks(uid, offset / unitSize, len / unitSize, buffer, unitSize);
+        if (ISO15693_EC_OK == rc) {
+          return true;
+        }
+        if ((ISO15693_EC_NOT_SUPPORTED != rc) && (ISO15693_EC_OPTION_NOT_SUPPORTED != rc)) {
+          return false;
+        }
+        PN5180DEBUG(F("NDEF: no READ MULTIPLE BLOCKS, falling back to READ SINGLE BLOCK\n"));
+        fastReadSupported = false;
+      }
+      for (uint16_t pos=0; pos<len; pos+=unitSize) {
+        ISO15693ErrorCode rc = extendedBlocks ?
+          iso15693->readSingleBlockExtended(uid, (offset + pos) / unitSize, buffer + pos, unitSize) :
+          iso15693->readSingleBlock(uid, (offset + pos) / unitSize, buffer + pos, unitSize);
+        if (ISO15693_EC_OK != rc) {
+          return false;
+        }
+      }
+      return true;
+  }
+  return false;
+}
+
+bool PN5180NDEF::writeUnits(uint32_t offset, uint8_t *buffer, uint16_t len) {
+  switch (tagType) {
+    case 2:
+      return (len/4 == iso14443->ntagWritePages(offset / 4, buffer, len/4));
+    case 4:
+      for (uint16_t pos=0; pos<len; ) {
+        uint16_t n = len - pos;
+        if (n > maxWriteLen) n = maxWriteLen;
+        uint8_t apdu[5 + n];
+        apdu[0] = 0x00;
+        apdu[1] = 0xD6;
+        apdu[2] = (offset + pos) >> 8;
+        apdu[3] = (offset + pos) & 0xFF;
+        apdu[4] = n;
+        memcpy(&apdu[5], buffer + pos, n);
+        uint8_t response[8];
+        uint16_t responseLen;
+        if (!type4Apdu(apdu, sizeof(apdu), response, sizeof(response), &responseLen)) {
+          return false;
+        }
+        pos += n;
+      }
+      return true;
+    case 5:
+      for (uint16_t pos=0; pos<len; pos+=unitSize) {
+        ISO15693ErrorCode rc = extendedBlocks ?
+          iso15693->writeSingleBlockExtended(uid, (offset + pos) / unitSize, buffer + pos, unitSize) :
+          iso15693->writeSingleBlock(uid, (offset + pos) / unitSize, buffer + pos, unitSize);
+        if (ISO15693_EC_OK != rc) {
+          return false;
+        }
+      }
+      return true;
+  }
+  return false;
+}
+
+/*
+ * Capability container of Type 2 (page 3) and Type 5 (block 0) tags.
+ * Returns the byte range of the data area holding the TLVs.
+ */
+bool PN5180NDEF::readCapabilityContainer(uint32_t *dataStart, uint32_t *dataEnd) {
+  uint8_t cc[32];
+  if (2 == tagType) {
+    if (!readUnits(12, cc, 4) || (0xE1 != cc[0])) {
+      PN5180DEBUG(F("NDEF: no Type 2 capability container\n"));
+      return false;
+    }
+    *dataStart = 16;
+    *dataEnd = 16 + cc[2] * 8;
+    return true;
+  }
+
+  // the 8 byte CC spans two blocks on tags with 4 byte blocks
+  if (!readUnits(0, cc, (unitSize < 8) ? 8 : unitSize) || ((0xE1 != cc[0]) && (0xE2 != cc[0]))) {
+    PN5180DEBUG(F("NDEF: no Type 5 capability container\n"));
+    return false;
+  }
+  if (0 != cc[2]) {
+    *dataStart = 4;
+    *dataEnd = 4 + cc[2] * 8;
+  }
+  else {
+    *dataStart = 8;
+    *dataEnd = 8 + (((uint32_t)cc[6] << 8) | cc[7]) * 8;
+  }
+  return true;
+}
+
+/*
+ * Walk the TLVs of the data area up to the NDEF message TLV. Lock and memory
+ * control TLVs are skipped by their length, NULL TLVs byte by byte.
+ *
+ * tlvOffset: the NDEF TLV if found, else the place a new one can be written,
+ * not set on a read error
+ * buffer: NDEF_CHUNK_SIZE bytes, holds the last window read, which starts
+ * at windowStart (windowLen 0 if nothing was read)
+ * return value: NDEF_TLV_FOUND, NDEF_TLV_NOT_FOUND after walking the whole
+ * TLV list, NDEF_TLV_READ_ERROR if the tag could not be read
+ */
+uint8_t PN5180NDEF::findNdefTlv(uint32_t dataStart, uint32_t dataEnd, uint32_t *tlvOffset, uint32_t *msgOffset, uint32_t *msgLen,
+                                uint8_t *buffer, uint32_t *windowStart, uint16_t *windowLen) {
+  *windowStart = 0;
+  *windowLen = 0;
+  uint32_t freeOffset = dataStart;
+  uint32_t pos = dataStart;
+
+  while (pos < dataEnd) {
+    // tag and 3 byte length field have to be in the buffer
+    uint32_t need = ((dataEnd - pos) < 4) ? (dataEnd - pos) : 4;
+    if ((pos < *windowStart) || (pos + need > *windowStart + *windowLen)) {
+      *windowStart = pos - (pos % unitSize);
+      *windowLen = NDEF_CHUNK_SIZE;
+      if (*windowStart + *windowLen > dataEnd) {
+        *windowLen = ((dataEnd - *windowStart + unitSize - 1) / unitSize) * unitSize;
+      }
+      if (!readUnits(*windowStart, buffer, *windowLen)) {
+        *windowLen = 0;
+        return NDEF_TLV_READ_ERROR;
+      }
+    }
+
+    const uint8_t *tlv = buffer + (pos - *windowStart);
+    if (NDEF_TLV_NULL == tlv[0]) {
+      pos++;
+      continue;
+    }
+    if ((NDEF_TLV_TERMINATOR == tlv[0]) || (need < 2)) {
+      break;
+    }
+
+    uint32_t len = tlv[1];
+    uint8_t headerLen = 2;
+    if (0xFF == len) {
+      if (need < 4) {
+        break;
+      }
+      len = ((uint32_t)tlv[2] << 8) | tlv[3];
+      headerLen = 4;
+    }
+    if (NDEF_TLV_MESSAGE == tlv[0]) {
+      *tlvOffset = pos;
+      *msgOffset = pos + headerLen;
+      *msgLen = len;
+      return NDEF_TLV_FOUND;
+    }
+    pos += headerLen + len;
+    freeOffset = pos;
+  }
+
+  *tlvOffset = freeOffset;
+  return NDEF_TLV_NOT_FOUND;
+}
+
+/*
+ * Read the message in NDEF_CHUNK_SIZE pieces and feed it to the parser,
+ * stopping after the last record or when the callback asks to. buffer
+ * (NDEF_CHUNK_SIZE bytes) already holds the first buffered bytes of the
+ * message, reading continues behind them.
+ */
+bool PN5180NDEF::streamMessage(uint32_t offset, uint32_t length, NdefRecordCallback callback, void *context, uint8_t *buffer, uint16_t buffered) {
+  NdefParser parser(callback, context);
+
+  if (buffered > 0) {
+    if (!parser.feed(buffer, buffered) || parser.isComplete()) {
+      return true;
+    }
+    offset += buffered;
+    length -= buffered;
+  }
+  while (length > 0) {
+    uint16_t skip = offset % unitSize;
+    uint16_t n = NDEF_CHUNK_SIZE - skip;
+    if (n > length) n = length;
+    uint16_t units = ((skip + n + unitSize - 1) / unitSize) * unitSize;
+    if (!readUnits(offset - skip, buffer, units)) {
+      return false;
+    }
+    if (!parser.feed(buffer + skip, n) || parser.isComplete()) {
+      return true;
+    }
+    offset += n;
+    length -= n;
+  }
+  return parser.isComplete();
+}
+
+bool PN5180NDEF::readTlvMessage(NdefRecordCallback callback, void *context) {
+  uint32_t dataStart, dataEnd, tlvOffset, msgOffset, msgLen;
+  uint8_t buffer[NDEF_CHUNK_SIZE];
+  uint32_t windowStart;
+  uint16_t windowLen;
+  messageLength = 0;
+  if (!readCapabilityContainer(&dataStart, &dataEnd)) {
+    return false;
+  }
+  if (NDEF_TLV_FOUND != findNdefTlv(dataStart, dataEnd, &tlvOffset, &msgOffset, &msgLen, buffer, &windowStart, &windowLen)) {
+    PN5180DEBUG(F("NDEF: no message TLV\n"));
+    return false;
+  }
+  if (msgOffset + msgLen > dataEnd) {
+    return false;
+  }
+  messageLength = msgLen;
+  if (0 == msgLen) {
+    return true;
+  }
+
+  // the window holding the TLV usually holds the start of the message too
+  uint16_t buffered = 0;
+  if (msgOffset < windowStart + windowLen) {
+    buffered = windowStart + windowLen - msgOffset;
+    if (buffered > msgLen) buffered = msgLen;
+    memmove(buffer, buffer + (msgOffset - windowStart), buffered);
+  }
+  return streamMessage(msgOffset, msgLen, callback, context, buffer, buffered);
+}
+
+/*
+ * Write the message as NDEF TLV, followed by a terminator TLV if there is
+ * room, in place of the existing message or after the control TLVs.
+ * Only the first and last unit are read back to keep the bytes around the TLV.
+ */
+bool PN5180NDEF::writeTlvMessage(const uint8_t *message, uint16_t len) {
+  uint32_t dataStart, dataEnd, tlvOffset, msgOffset, msgLen;
+  if (!readCapabilityContainer(&dataStart, &dataEnd)) {
+    return false;
+  }
+  uint8_t buffer[NDEF_CHUNK_SIZE];
+  uint32_t windowStart;
+  uint16_t windowLen;
+  if (NDEF_TLV_READ_ERROR == findNdefTlv(dataStart, dataEnd, &tlvOffset, &msgOffset, &msgLen, buffer, &windowStart, &windowLen)) {
+    PN5180DEBUG(F("NDEF: reading the TLVs failed\n"));
+    return false;
+  }
+
+  uint8_t header[4] = { NDEF_TLV_MESSAGE, (uint8_t)len, 0, 0 };
+  uint8_t headerLen = 2;
+  if (len >= 0xFF) {
+    header[1] = 0xFF;
+    header[2] = len >> 8;
+    header[3] = len & 0xFF;
+    headerLen = 4;
+  }
+  uint32_t total = headerLen + len;
+  if (tlvOffset + total > dataEnd) {
+    PN5180DEBUG(F("NDEF: message does not fit\n"));
+    return false;
+  }
+  if (tlvOffset + total < dataEnd) {
+    total++;
+  }
+
+  uint32_t offset = tlvOffset;
+  for (uint32_t i=0; i<total; ) {
+    uint16_t skip = offset % unitSize;
+    uint16_t n = NDEF_CHUNK_SIZE - skip;
+    if (n > total - i) n = total - i;
+    uint16_t units = ((skip + n + unitSize - 1) / unitSize) * unitSize;
+    if ((skip > 0) || (units != n)) {
+      if (!readUnits(offset - skip, buffer, units)) {
+        return false;
+      }
+    }
+    for (uint16_t k=0; k<n; k++) {
+      uint32_t pos = i + k;
+      uint8_t b;
+      if (pos < headerLen) b = header[pos];
+      else if (pos < (uint32_t)headerLen + len) b = message[pos - headerLen];
+      else b = NDEF_TLV_TERMINATOR;
+      buffer[skip + k] = b;
+    }
+    if (!writeUnits(offset - skip, buffer, units)) {
+      return false;
+    }
+    offset += n;
+    i += n;
+  }
+  messageLength = len;
+  return true;
+}
+
+bool PN5180NDEF::type4Apdu(uint8_t *apdu, uint8_t apduLen, uint8_t *response, uint16_t maxResponseLen, uint16_t *responseLen) {
+  uint16_t len = iso14443->exchangeApdu(apdu, apduLen, response, maxResponseLen, NDEF_TYPE4_READ_DELAY);
+  if ((len < 2) || (0x90 != response[len-2]) || (0x00 != response[len-1])) {
+    PN5180DEBUG(F("NDEF: APDU failed\n"));
+    *responseLen = 0;
+    return false;
+  }
+  *responseLen = len - 2;
+  return true;
+}
+
+bool PN5180NDEF::type4Select(const uint8_t *fileId) {
+  uint8_t apdu[] = { 0x00, 0xA4, 0x00, 0x0C, 0x02, fileId[0], fileId[1] };
+  uint8_t response[8];
+  uint16_t responseLen;
+  return type4Apdu(apdu, sizeof(apdu), response, sizeof(response), &responseLen);
+}
+
+/*
+ * Select the NDEF application and the capability container file E103, take
+ * MLe, MLc and the NDEF file ID from the CC and select the NDEF file.
+ */
+bool PN5180NDEF::type4Prepare(bool write) {
+  uint8_t selectApp[] = { 0x00, 0xA4, 0x04, 0x00, 0x07, 0xD2, 0x76, 0x00, 0x00, 0x85, 0x01, 0x01, 0x00 };
+  uint8_t response[NDEF_CHUNK_SIZE + 8];
+  uint16_t responseLen;
+  if (!type4Apdu(selectApp, sizeof(selectApp), response, sizeof(response), &responseLen)) {
+    return false;
+  }
+  const uint8_t ccFile[2] = { 0xE1, 0x03 };
+  if (!type4Select(ccFile)) {
+    return false;
+  }
+
+  tagType = 4;
+  unitSize = 1;
+  maxReadLen = 15;
+  uint8_t cc[15];
+  if (!readUnits(0, cc, sizeof(cc)) || (0x04 != cc[7])) {
+    PN5180DEBUG(F("NDEF: no NDEF file control TLV\n"));
+    return false;
+  }
+
+  // keep reads and writes within the short APDU and chunk buffer limits
+  maxReadLen = ((uint16_t)cc[3] << 8) | cc[4];
+  maxWriteLen = ((uint16_t)cc[5] << 8) | cc[6];
+  if (maxReadLen > NDEF_CHUNK_SIZE) maxReadLen = NDEF_CHUNK_SIZE;
+  if (maxWriteLen > NDEF_CHUNK_SIZE) maxWriteLen = NDEF_CHUNK_SIZE;
+  if ((0 == maxReadLen) || (0 == maxWriteLen)) {
+    return false;
+  }
+  ndefFileSize = ((uint16_t)cc[11] << 8) | cc[12];
+  if (write && (0x00 != cc[14])) {
+    PN5180DEBUG(F("NDEF: file is read-only\n"));
+    return false;
+  }
+  return type4Select(&cc[9]);
+}
+
+/*
+ * NFC Forum Type 2 tag (NTAG, Ultralight). The tag has to be activated.
+ * A tag without FAST_READ costs one reactivation on the first read.
+ */
+bool PN5180NDEF::readType2(NdefRecordCallback callback, void *context) {
+  tagType = 2;
+  unitSize = 4;
+  fastReadSupported = true;
+  return readTlvMessage(callback, context);
+}
+
+/*
+ * NFC Forum Type 4 tag. The tag has to be activated and ISO-DEP started.
+ * Only the NLEN field and the bytes of the message are read.
+ */
+bool PN5180NDEF::readType4(NdefRecordCallback callback, void *context) {
+  messageLength = 0;
+  if (!type4Prepare(false)) {
+    return false;
+  }
+  uint8_t nlen[2];
+  if (!readUnits(0, nlen, 2)) {
+    return false;
+  }
+  uint16_t len = ((uint16_t)nlen[0] << 8) | nlen[1];
+  if (len + 2 > ndefFileSize) {
+    return false;
+  }
+  messageLength = len;
+  if (0 == len) {
+    return true;
+  }
+  uint8_t buffer[NDEF_CHUNK_SIZE];
+  return streamMessage(2, len, callback, context, buffer, 0);
+}
+
+/*
+ * NFC Forum Type 5 tag (ISO15693), addressed by its UID.
+ */
+bool PN5180NDEF::readType5(uint8_t *uid, NdefRecordCallback callback, void *context) {
+  uint8_t blockSize;
+  uint16_t numBlocks;
+  if (ISO15693_EC_OK != iso15693->getMemorySize(uid, &blockSize, &numBlocks)) {
+    return false;
+  }
+  tagType = 5;
+  this->uid = uid;
+  unitSize = blockSize;
+  extendedBlocks = (numBlocks > 256);
+  fastReadSupported = true;
+  return readTlvMessage(callback, context);
+}
+
+bool PN5180NDEF::writeType2(const uint8_t *message, uint16_t len) {
+  tagType = 2;
+  unitSize = 4;
+  fastReadSupported = true;
+  return writeTlvMessage(message, len);
+}
+
+/*
+ * NLEN is cleared before and set after the message is written, so an
+ * interrupted write leaves an empty instead of a broken message.
+ */
+bool PN5180NDEF::writeType4(const uint8_t *message, uint16_t len) {
+  if (!type4Prepare(true) || (len + 2 > ndefFileSize)) {
+    return false;
+  }
+  uint8_t nlen[2] = { 0x00, 0x00 };
+  if (!writeUnits(0, nlen, 2)) {
+    return false;
+  }
+  uint8_t buffer[NDEF_CHUNK_SIZE];
+  for (uint16_t pos=0; pos<len; ) {
+    uint16_t n = len - pos;
+    if (n > NDEF_CHUNK_SIZE) n = NDEF_CHUNK_SIZE;
+    memcpy(buffer, message + pos, n);
+    if (!writeUnits(2 + pos, buffer, n)) {
+      return false;
+    }
+    pos += n;
+  }
+  nlen[0] = len >> 8;
+  nlen[1] = len & 0xFF;
+  if (!writeUnits(0, nlen, 2)) {
+    return false;
+  }
+  messageLength = len;
+  return true;
+}
+
+bool PN5180NDEF::writeType5(uint8_t *uid, const uint8_t *message, uint16_t len) {
+  uint8_t blockSize;
+  uint16_t numBlocks;
+  if (ISO15693_EC_OK != iso15693->getMemorySize(uid, &blockSize, &numBlocks)) {
+    return false;
+  }
+  tagType = 5;
+  this->uid = uid;
+  unitSize = blockSize;
+  extendedBlocks = (numBlocks > 256);
+  fastReadSupported = true;
+  return writeTlvMessage(message, len);
+}
+
+/*
+ * Length of the message found by the last read, or written by the last write.
+ */
+uint32_t PN5180NDEF::getMessageLength() {
+  return messageLength;
+}
@@ -0,0 +1,137 @@
+// NAME: PN5180NDEF.h
+//
+// DESC: NFC Forum NDEF read and write for Type 2, Type 4 and Type 5 tags
+//       with a streaming record parser.
+//
+// Copyright (c) 2026 by HOCC2011. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+#ifndef PN5180NDEF_H
+#define PN5180NDEF_H
+
+#include "PN5180ISO14443.h"
+#include "PN5180ISO15693.h"
+
+// size of the buffer a read or write goes through, must be a multiple of 32
+// (largest ISO15693 block). Larger values mean fewer, longer commands.
+#ifndef NDEF_CHUNK_SIZE
+#define NDEF_CHUNK_SIZE       64
+#endif
+// record type and ID bytes kept in NdefRecord, longer fields are cut off
+#ifndef NDEF_MAX_TYPE_LENGTH
+#define NDEF_MAX_TYPE_LENGTH  32
+#endif
+#ifndef NDEF_MAX_ID_LENGTH
+#define NDEF_MAX_ID_LENGTH    16
+#endif
+
+#define NDEF_TNF_EMPTY        0x00
+#define NDEF_TNF_WELL_KNOWN   0x01
+#define NDEF_TNF_MIME_MEDIA   0x02
+#define NDEF_TNF_ABSOLUTE_URI 0x03
+#define NDEF_TNF_EXTERNAL     0x04
+#define NDEF_TNF_UNKNOWN      0x05
+#define NDEF_TNF_UNCHANGED    0x06
+
+/*
+ * Header of the record currently parsed. typeLength and idLength are the
+ * lengths on the tag, only the first NDEF_MAX_TYPE_LENGTH/NDEF_MAX_ID_LENGTH
+ * bytes are stored.
+ */
+struct NdefRecord {
+  uint8_t index;          // position of the record in the message, starting at 0
+  uint8_t flags;          // header byte: MB 0x80, ME 0x40, CF 0x20, SR 0x10, IL 0x08
+  uint8_t tnf;            // type name format, NDEF_TNF_*
+  uint8_t typeLength;
+  uint8_t type[NDEF_MAX_TYPE_LENGTH];
+  uint8_t idLength;
+  uint8_t id[NDEF_MAX_ID_LENGTH];
+  uint32_t payloadLength;
+};
+
+/*
+ * Called for each piece of payload as it arrives from the tag, at least once
+ * per record (len 0 for an empty payload). offset is the position of the piece
+ * within the payload, the record is complete when offset+len == payloadLength.
+ * payload points into the read buffer and is only valid during the call.
+ * Return false to stop reading, no further commands are sent to the tag.
+ */
+typedef bool (*NdefRecordCallback)(const NdefRecord *record, const uint8_t *payload, uint16_t len, uint32_t offset, void *context);
+
+class NdefParser {
+
+public:
+  NdefParser(NdefRecordCallback callback, void *context);
+
+private:
+  NdefRecordCallback callback;
+  void *context;
+  NdefRecord record;
+  uint8_t state;
+  uint8_t fieldPos;
+  uint32_t payloadPos;
+  bool complete;
+  bool stopped;
+  void startFields();
+  void beginPayload();
+  void endRecord();
+
+public:
+  bool feed(const uint8_t *data, uint16_t len);
+  bool isComplete();
+  bool isStopped();
+};
+
+class PN5180NDEF {
+
+public:
+  PN5180NDEF(PN5180ISO14443 &reader);
+  PN5180NDEF(PN5180ISO15693 &reader);
+
+private:
+  PN5180ISO14443 *iso14443;
+  PN5180ISO15693 *iso15693;
+  uint8_t tagType;          // 2, 4 or 5 while an operation runs
+  uint8_t *uid;             // Type 5 UID
+  uint8_t unitSize;         // granularity of reads and writes: page, block or byte
+  uint16_t maxReadLen;      // Type 4 MLe
+  uint16_t maxWriteLen;     // Type 4 MLc
+  uint16_t ndefFileSize;    // Type 4 max. NDEF file size
+  bool fastReadSupported;  // Type 2 FAST_READ, Type 5 READ MULTIPLE BLOCKS
+  bool extendedBlocks;     // Type 5 with more than 256 blocks: extended commands
+  uint32_t messageLength;
+
+  bool readUnits(uint32_t offset, uint8_t *buffer, uint16_t len);
+  bool writeUnits(uint32_t offset, uint8_t *buffer, uint16_t len);
+  bool readCapabilityContainer(uint32_t *dataStart, uint32_t *dataEnd);
+  uint8_t findNdefTlv(uint32_t dataStart, uint32_t dataEnd, uint32_t *tlvOffset, uint32_t *msgOffset, uint32_t *msgLen,
+                      uint8_t *buffer, uint32_t *windowStart, uint16_t *windowLen);
+  bool streamMessage(uint32_t offset, uint32_t length, NdefRecordCallback callback, void *context, uint8_t *buffer, uint16_t buffered);
+  bool readTlvMessage(NdefRecordCallback callback, void *context);
+  bool writeTlvMessage(const uint8_t *message, uint16_t len);
+  bool type4Apdu(uint8_t *apdu, uint8_t apduLen, uint8_t *response, uint16_t maxResponseLen, uint16_t *responseLen);
+  bool type4Select(const uint8_t *fileId);
+  bool type4Prepare(bool write);
+
+public:
+  bool readType2(NdefRecordCallback callback, void *context);
+  bool readType4(NdefRecordCallback callback, void *context);
+  bool readType5(uint8_t *uid, NdefRecordCallback callback, void *context);
+  bool writeType2(const uint8_t *message, uint16_t len);
+  bool writeType4(const uint8_t *message, uint16_t len);
+  bool writeType5(uint8_t *uid, const uint8_t *message, uint16_t len);
+  uint32_t getMessageLength();
+};
+
+#endif /* PN5180NDEF_H */
@@ -0,0 +1,169 @@
+// NAME: PN5180TLV.cpp
+//
+// DESC: Zero-copy BER-TLV parser for ISO7816 APDU responses.
+//
+// Copyright (c) 2026 by HOCC2011. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+//#define DEBUG 1
+
+#include <Arduino.h>
+#include "PN5180TLV.h"
+#include "Debug.h"
+
+// nesting limit for the recursive tag search, protects the stack against hostile input
+#define BER_TLV_MAX_DEPTH   8
+
+BerTlvParser::BerTlvParser(const uint8_t *data, uint16_t len) {
+  pos = data;
+  end = data + len;
+  malformed = false;
+}
+
+BerTlvParser::BerTlvParser(const BerTlv &parent) {
+  pos = parent.value;
+  end = parent.value + parent.length;
+  malformed = false;
+}
+
+/*
+ * Parse the next TLV element of the current level.
+ *
+ * Tag field: if bits b5..b1 of the first byte are all set, further tag bytes follow
+ * as long as bit b8 of the previous byte is set (ISO7816-4, 5.2.2.1).
+ * Length field: 0x00-0x7F is the length itself, 0x81 and 0x82 announce 1 or 2
+ * following length bytes. Longer or indefinite lengths do not occur in APDU
+ * responses and are rejected.
+ * Padding bytes 0x00 and 0xFF between elements are skipped.
+ *
+ * If the value runs past the end of the buffer, the element is returned with the
+ * available bytes and the truncated flag set. Parsing stops after that element.
+ *
+ * return value: true if an element was found, false at the end of the buffer
+ * or on malformed input (see isMalformed()).
+ */
+bool BerTlvParser::next(BerTlv *tlv) {
+  while ((pos < end) && ((0x00 == *pos) || (0xFF == *pos))) {
+    pos++;
+  }
+  if (pos >= end) {
+    return false;
+  }
+
+  uint8_t first = *pos++;
+  uint32_t tag = first;
+  if (0x1F == (first & 0x1F)) {
+    uint8_t b;
+    do {
+      if ((pos >= end) || (tag > 0x00FFFFFF)) {
+        PN5180DEBUG(F("BER-TLV: truncated tag\n"));
+        malformed = true;
+        return false;
+      }
+      b = *pos++;
+      tag = (tag << 8) | b;
+    } while (b & 0x80);
+  }
+
+  if (pos >= end) {
+    PN5180DEBUG(F("BER-TLV: missing length\n"));
+    malformed = true;
+    return false;
+  }
+  uint16_t len = *pos++;
+  if (len & 0x80) {
+    uint8_t numBytes = len & 0x7F;
+    if ((numBytes < 1) || (numBytes > 2) || ((end - pos) < numBytes)) {
+      PN5180DEBUG(F("BER-TLV: unsupported length field\n"));
+      malformed = true;
+      return false;
+    }
+    len = 0;
+    for (int i=0; i<numBytes; i++) {
+      len = (len << 8) | *pos++;
+    }
+  }
+
+  tlv->tag = tag;
+  tlv->value = pos;
+  tlv->constructed = (0 != (first & 0x20));
+  tlv->truncated = false;
+  if ((end - pos) < len) {
+    PN5180DEBUG(F("BER-TLV: value truncated\n"));
+    len = end - pos;
+    tlv->truncated = true;
+  }
+  tlv->length = len;
+  pos += len;
+  return true;
+}
+
+bool BerTlvParser::isMalformed() {
+  return malformed;
+}
+
+/*
+ * Depth-first search for the first element with the given tag, on any nesting level.
+ */
+static bool findTag(const uint8_t *data, uint16_t len, uint32_t tag, BerTlv *tlv, uint8_t depth) {
+  BerTlvParser parser(data, len);
+  BerTlv element;
+  while (parser.next(&element)) {
+    if (element.tag == tag) {
+      *tlv = element;
+      return true;
+    }
+    if (element.constructed && (depth < BER_TLV_MAX_DEPTH)) {
+      if (findTag(element.value, element.length, tag, tlv, depth+1)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+bool BerTlvParser::find(const uint8_t *data, uint16_t len, uint32_t tag, BerTlv *tlv) {
+  return findTag(data, len, tag, tlv, 0);
+}
+
+/*
+ * Follow a tag path from the outermost element inwards, e.g. for the AID
+ * in a PPSE response: { 0x6F, 0xA5, 0xBF0C, 0x61, 0x4F }.
+ * On each level the first matching element is taken.
+ */
+bool BerTlvParser::findPath(const uint8_t *data, uint16_t len, const uint32_t *path, uint8_t depth, BerTlv *tlv) {
+  if (0 == depth) {
+    return false;
+  }
+
+  BerTlv element;
+  element.value = data;
+  element.length = len;
+  for (int level=0; level<depth; level++) {
+    BerTlvParser parser(element);
+    bool found = false;
+    while (parser.next(&element)) {
+      if (element.tag == path[level]) {
+        found = true;
+        break;
+      }
+    }
+    if (!found) {
+      return false;
+    }
+  }
+
+  *tlv = element;
+  return true;
+}
@@ -0,0 +1,55 @@
+// NAME: PN5180TLV.h
+//
+// DESC: Zero-copy BER-TLV parser for ISO7816 APDU responses.
+//
+// Copyright (c) 2026 by HOCC2011. All rights reserved.
+//
+// This file is part of the PN5180 library for the Arduino environment.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Lesser General Public License for more details.
+//
+#ifndef PN5180TLV_H
+#define PN5180TLV_H
+
+#include <stdint.h>
+
+/*
+ * One BER-TLV element. The value pointer references the parsed buffer,
+ * nothing is copied, so the element is only valid as long as the buffer is.
+ */
+struct BerTlv {
+  uint32_t tag;           // complete tag, e.g. 0x6F, 0xBF0C
+  const uint8_t *value;   // start of value field inside the parsed buffer
+  uint16_t length;        // number of value bytes available in the buffer
+  bool constructed;       // value contains nested TLVs
+  bool truncated;         // encoded length exceeds the buffer, length was clipped
+};
+
+class BerTlvParser {
+
+public:
+  BerTlvParser(const uint8_t *data, uint16_t len);
+  BerTlvParser(const BerTlv &parent);
+
+private:
+  const uint8_t *pos;
+  const uint8_t *end;
+  bool malformed;
+
+public:
+  bool next(BerTlv *tlv);
+  bool isMalformed();
+
+  static bool find(const uint8_t *data, uint16_t len, uint32_t tag, BerTlv *tlv);
+  static bool findPath(const uint8_t *data, uint16_t len, const uint32_t *path, uint8_t depth, BerTlv *tlv);
+};
+
+#endif /* PN5180TLV_H */
@@ -1,6 +1,8 @@
 #include <Debug.h>
 #include <PN5180.h>
 #include <PN5180ISO14443.h>
+#include <PN5180TLV.h>
+#include <PN5180Hex.h>
 
 #define PN5180_RST  4
 #define PN5180_NSS  5
@@ -49,6 +51,8 @@ void setup() {
 
   Serial.println(F("Enabling RF field..."));
   nfc.setupRF();
+  // keep the ISO-DEP session of a card that stays in the field instead of re-activating it
+  nfc.setPresenceCheckMode(true);
   rgbLedWrite(21, RGB_BRIGHTNESS, RGB_BRIGHTNESS, RGB_BRIGHTNESS); 
 }
 
@@ -80,9 +84,19 @@ void loop() {
     // Send the command and automatically get the length and data
     responseLength = nfc.exchangeApdu(selectCommand, sizeof(selectCommand), response, sizeof(response), 10);
     if (responseLength > 0) {
+      char hex[2*sizeof(response)+1];
+      hexEncode(response, responseLength, hex, sizeof(hex));
       Serial.print(F("Response data: "));
-      Serial.print(bytesToHex(response, responseLength));
-      Serial.println(F(""));
+      Serial.println(hex);
+
+      // FCI template / FCI proprietary template / FCI issuer discretionary data / directory entry / AID
+      const uint32_t aidPath[] = { 0x6F, 0xA5, 0xBF0C, 0x61, 0x4F };
+      BerTlv aid;
+      if ((responseLength > 2) && BerTlvParser::findPath(response, responseLength-2, aidPath, 5, &aid)) { // skip SW1 SW2
+        Serial.print(F("First AID: "));
+        hexEncode(aid.value, aid.length, hex, sizeof(hex));
+        Serial.println(hex);
+      }
     } else {
       Serial.println(F("responseLength is < 0"));
     }
@@ -90,16 +104,6 @@ void loop() {
   delay(1000);
 }
 
-String bytesToHex(unsigned char* data, unsigned int len) {
-  String hexString = "";
-  for (unsigned int i = 0; i < len; i++) {
-    char temp[3]; // 2 chars for hex, 1 for null terminator
-    sprintf(temp, "%02X", data[i]);
-    hexString += temp;
-  }
-  return hexString;
-}
-
 void showIRQStatus(uint32_t irqStatus) {
   Serial.print(F("IRQ-Status 0x"));
   Serial.print(irqStatus, HEX);